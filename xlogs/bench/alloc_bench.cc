@@ -0,0 +1,112 @@
+#include"../include/xlog.h"
+#include"alloc_counter.hpp"
+
+#include<iostream>
+#include<iomanip>
+#include<functional>
+#include<vector>
+#include<cstdlib>
+
+/*
+  分配回归检查 -- 以XLOG_ALLOC_TRACE构建,按阶段统计每次日志调用的堆分配
+  阶段: vasprintf / LogMsg / format / buffer / sink / other (见alloc_trace.hpp)
+
+  每个用例先预热(让线程局部缓冲区,Buffer等达到稳态),再统计iters次调用
+  标记为零分配的用例只要出现一次分配即判定失败,进程返回1,用于防止热路径分配回归
+  只统计调用线程的分配: 异步日志器后台线程的分配不计入
+  Makefile以绝对路径编译,__FILE__较长(超出std::string的短字符串优化),与真实项目的调用一致
+
+  用法: alloc_bench [迭代次数=100000]
+*/
+
+//空落地 -- 不分配
+class NullSink:public log::LogSink{
+  public:
+    void log(const char* data,size_t len)override{
+      (void)data;
+      _bytes += len;
+    }
+    void logv(const struct iovec* iov,int cnt)override{
+      for(int i = 0;i<cnt;i++) _bytes += iov[i].iov_len;
+    }
+    size_t _bytes = 0;
+};
+
+struct Case{
+  std::string name;
+  bool zero_alloc;            //配置为零分配的路径
+  std::function<void()> fn;
+};
+
+static log::Logger::s_ptr makeLogger(const std::string& name,log::LoggerType type,log::LogLevel::Value level){
+  std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+  builder->buildLoggerName(name);
+  builder->buildLoggerType(type);
+  builder->buildLoggerLevel(level);
+  builder->buildSink<NullSink>();
+  return builder->build();
+}
+
+//返回是否通过
+static bool runCase(const Case& c,size_t iters){
+  for(size_t i = 0;i<iters/10+1;i++) c.fn(); //预热
+  bench::AllocStats t0 = bench::threadAllocSnapshot();
+  log::alloctrace::PhaseStats p0 = log::alloctrace::snapshot();
+  for(size_t i = 0;i<iters;i++) c.fn();
+  bench::AllocStats t1 = bench::threadAllocSnapshot();
+  log::alloctrace::PhaseStats p1 = log::alloctrace::snapshot();
+
+  uint64_t count = t1.count-t0.count;
+  bool ok = !c.zero_alloc || count==0;
+  std::cout<<std::left<<std::setw(34)<<c.name
+           <<std::right<<std::fixed<<std::setw(8)<<std::setprecision(2)<<(double)count/iters<<" allocs/op"
+           <<std::setw(10)<<std::setprecision(1)<<(double)(t1.bytes-t0.bytes)/iters<<" B/op"
+           <<(c.zero_alloc? (ok? "  [zero-alloc OK]":"  [zero-alloc FAIL]"):"")<<"\n";
+  //阶段计数是全进程的; 只列出有分配的阶段
+  for(int i = 0;i<log::alloctrace::PHASE_COUNT;i++){
+    uint64_t n = p1.count[i]-p0.count[i];
+    if(n==0) continue;
+    std::cout<<"    "<<std::left<<std::setw(12)<<log::alloctrace::phaseName(i)
+             <<std::right<<std::setw(8)<<std::setprecision(2)<<(double)n/iters<<" allocs/op"
+             <<std::setw(10)<<std::setprecision(1)<<(double)(p1.bytes[i]-p0.bytes[i])/iters<<" B/op\n";
+  }
+  return ok;
+}
+
+int main(int argc,char* argv[]){
+  size_t iters = argc>1? std::strtoul(argv[1],nullptr,10):100000;
+
+  std::cout<<"__FILE__ = "<<__FILE__<<"\n";
+  log::Logger::s_ptr sync = makeLogger("sync",log::LoggerType::LOGGER_SYNC,log::LogLevel::Value::DEBUG);
+  log::Logger::s_ptr async = makeLogger("async",log::LoggerType::LOGGER_ASYNC,log::LogLevel::Value::DEBUG);
+  log::Logger::s_ptr quiet = makeLogger("quiet",log::LoggerType::LOGGER_SYNC,log::LogLevel::Value::ERROR);
+
+  log::Formatter formatter;
+  log::LogMsg msg(log::LogLevel::Value::INFO,__FILE__,42,"root",std::string(100,'x'));
+  std::string out;
+  log::Buffer buffer;
+  std::string line(100,'x');
+  std::string big(16*1024,'x');
+
+  std::vector<Case> cases = {
+    {"Formatter::format(复用缓冲区)",true,[&](){ out.clear(); formatter.format(out,msg); }},
+    {"Buffer::push(稳态)",true,[&](){ buffer.push(line.data(),line.size()); if(buffer.readAbleSize()>512*1024) buffer.reset(); }},
+    {"低于等级的info",true,[&](){ quiet->info("%s %d",line.c_str(),42); }},
+    {"同步 payload 16KB",true,[&](){ sync->payload(log::LogLevel::Value::INFO,big.data(),big.size()); }},
+    {"异步 payload 16KB",true,[&](){ async->payload(log::LogLevel::Value::INFO,big.data(),big.size()); }},
+    {"同步 info(\"%s %d\")",false,[&](){ sync->info("%s %d",line.c_str(),42); }},
+    {"异步 info(\"%s %d\")",false,[&](){ async->info("%s %d",line.c_str(),42); }},
+  };
+
+  std::cout<<"--------------每次调用的堆分配(调用线程)--------------\n";
+  int failed = 0;
+  for(auto& c:cases){
+    if(!runCase(c,iters)) failed++;
+  }
+  if(failed){
+    std::cout<<failed<<" 个零分配用例出现分配\n";
+    return 1;
+  }
+  std::cout<<"零分配用例全部通过\n";
+  return 0;
+}
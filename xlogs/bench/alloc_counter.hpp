@@ -0,0 +1,69 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include<cstdlib>
+#include<cstdint>
+#include<atomic>
+#include<new>
+
+#include"../include/alloc_trace.hpp"
+
+/*
+  堆分配计数 -- 替换malloc/calloc/realloc,统计分配次数与字节数
+  operator new与vasprintf最终都经过malloc,因此都在统计之内
+  替换的函数转发给glibc的__libc_malloc等(glibc导出,专供替换malloc的程序使用)
+  注意: 替换函数不能inline,本头文件只能被一个翻译单元包含(每个bench程序只有一个.cc,满足要求)
+  定义XLOG_ALLOC_TRACE时同时按日志路径阶段记账(见alloc_trace.hpp)
+*/
+
+extern "C"{
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n,size_t size);
+  void* __libc_realloc(void* p,size_t size);
+}
+
+namespace bench{
+  struct AllocStats{
+    uint64_t count;
+    uint64_t bytes;
+  };
+
+  inline std::atomic<uint64_t>& allocCount(){ static std::atomic<uint64_t> c(0); return c; }
+  inline std::atomic<uint64_t>& allocBytes(){ static std::atomic<uint64_t> b(0); return b; }
+  //当前线程的计数: 异步日志器后台线程的分配不计入调用方
+  inline AllocStats& threadAlloc(){ static thread_local AllocStats s = {0,0}; return s; }
+
+  inline void countAlloc(size_t size){
+    allocCount().fetch_add(1,std::memory_order_relaxed);
+    allocBytes().fetch_add(size,std::memory_order_relaxed);
+    AllocStats& t = threadAlloc();
+    t.count++;
+    t.bytes += size;
+#ifdef XLOG_ALLOC_TRACE
+    log::alloctrace::record(size);
+#endif
+  }
+
+  inline AllocStats allocSnapshot(){
+    return AllocStats{allocCount().load(std::memory_order_relaxed),allocBytes().load(std::memory_order_relaxed)};
+  }
+  inline AllocStats threadAllocSnapshot(){ return threadAlloc(); }
+} //namespace_bench_END
+
+extern "C"{
+  void* malloc(size_t size){
+    bench::countAlloc(size);
+    return __libc_malloc(size);
+  }
+  void* calloc(size_t n,size_t size){
+    bench::countAlloc(n*size);
+    return __libc_calloc(n,size);
+  }
+  //realloc(nullptr,n)等同malloc; 原地缩小/扩大也按一次分配计算(vasprintf收尾时的realloc同样计入)
+  void* realloc(void* p,size_t size){
+    if(size) bench::countAlloc(size);
+    return __libc_realloc(p,size);
+  }
+}
+
+#endif
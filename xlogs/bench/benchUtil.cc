@@ -1,139 +1,192 @@
 #include"../include/xlog.h"
+#include"latency.hpp"
 
 #include<iostream>
+#include<fstream>
+#include<sstream>
 #include<thread>
 #include<vector>
+#include<atomic>
 #include<chrono>
+#include<cstdlib>
 
-void bench(const std::string&logger_name,size_t thr_count,size_t msg_count,size_t msg_len){
-  //获取日志器
-  //组织指定长度的日志消息
-  //创建指定数量的线程
-  //计时
-  //写日志
-  //结束计时
-  //计算总耗时
-  //整理输出
-  
-  std::cout<<"测试日志:"<<msg_count<<"条, ";
-  std::cout<<"线程数:" <<thr_count<<", ";
-  size_t size = msg_count*msg_len;
-  std::cout<<"总大小:"<<size/1024+size%1024<<" KB, ="<<size/(1024*1024)<<"."<<size%(1024*1024)<<"M\n";
-
-  log::Logger::s_ptr logger = log::getLogger(logger_name); 
-  if(logger.get() == nullptr){
-    return ;
+/* 测试环境:
+CPU:
+RAM:
+ROM:
+OS:
+*/
+
+/*测试方法:
+  1. 吞吐: 总条数/墙钟时间 -- 墙钟从所有线程同时起跑开始,到最后一个线程写完结束;
+           异步日志器另给出"落地完成"时间(析构等待异步线程写完缓冲区)
+  2. 延迟: 每次调用单独计时,每个线程记录到自己的直方图,结束后合并,给出 p50/p99/p99.9/max
+  测试要素: 同步/异步安全/异步非安全 x 线程数 x 单条日志长度
+
+  旧版问题(已修正):
+  - 多线程无锁push_back到共享的costs -- 数据竞争
+  - 以单个线程耗时除以全部条数 -- 吞吐偏高
+  - 只有吞吐,看不到尾延迟
+
+  用法:
+    bench [--types sync,sync_batch,async_safe,async_unsafe] [--threads 1,2,4] [--sizes 100]
+          [--count 1000000] [--format text|csv|json] [--out FILE]
+    另有 async_shardedK (如async_sharded4): K个分片的异步日志器,与async_safe对比入队的扩展性
+*/
+
+struct BenchConfig{
+  std::string type;   //sync | sync_batch | async_safe | async_unsafe | async_shardedK
+  size_t thr_count;
+  size_t msg_count;
+  size_t msg_len;
+};
+
+struct BenchResult{
+  BenchConfig conf;
+  double wall_s;      //生产耗时
+  double drain_s;     //到全部落地的耗时(同步日志器与wall_s相同)
+  bench::Histogram hist;
+};
+
+static log::Logger::s_ptr makeLogger(const BenchConfig& conf){
+  std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+  builder->buildLoggerName(conf.type);
+  if(conf.type=="sync_batch"){
+    builder->buildSyncBatching(); //同步日志器,线程局部批量
   }
+  else if(conf.type!="sync"){
+    builder->buildLoggerType(log::LoggerType::LOGGER_ASYNC);
+    if(conf.type=="async_unsafe") builder->buildEnableUnsafeAsync();
+    if(conf.type.compare(0,13,"async_sharded")==0) builder->buildShards(std::strtoul(conf.type.c_str()+13,nullptr,10));
+  }
+  std::stringstream path;
+  path<<"logs/"<<conf.type<<"-t"<<conf.thr_count<<"-s"<<conf.msg_len<<".log";
+  builder->buildSink<log::FileSink>(path.str());
+  return builder->build();
+}
+
+static BenchResult runBench(const BenchConfig& conf){
+  BenchResult res;
+  res.conf = conf;
 
-  std::string str(msg_len,'1'); //末尾留一个,自动填充'\0'
+  log::Logger::s_ptr logger = makeLogger(conf);
+  std::string str(conf.msg_len,'1');
 
   std::vector<std::thread> threads;
-  std::vector<double> costs;
-
-  for(size_t i = 0;i<thr_count;i++){
-    threads.emplace_back([&,i](){
-        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
-        for(size_t j = 0;j<msg_count/thr_count;j++){
-          logger->debug("%s",str.c_str());
-	  //DEBUG("%s",str.c_str());
-        }
-        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> cost = end - start;
-        costs.push_back(cost.count());
-        std::cout<<"\t线程"<<i<<"耗时:"<<cost.count()<<"s,"<<"平均:"<<(size_t)(msg_count/cost.count())<<"条/s"<<std::endl;
-        
+  std::vector<bench::Histogram> hists(conf.thr_count); //每线程独立,无共享写
+  std::atomic<size_t> ready(0);
+  std::atomic<bool> go(false);
+
+  for(size_t i = 0;i<conf.thr_count;i++){
+    //余数分给前几个线程,保证总条数精确等于msg_count
+    size_t n = conf.msg_count/conf.thr_count+(i<conf.msg_count%conf.thr_count? 1:0);
+    threads.emplace_back([&,i,n](){
+      bench::Histogram& hist = hists[i];
+      ready++;
+      while(!go.load(std::memory_order_acquire)){} //起跑线
+      for(size_t j = 0;j<n;j++){
+        uint64_t start = bench::nowNs();
+        logger->debug("%s",str.c_str());
+        hist.record(bench::nowNs()-start);
+      }
     });
   }
 
-  for(auto& th: threads){
+  while(ready.load()<conf.thr_count){ std::this_thread::yield(); }
+  auto start = std::chrono::steady_clock::now();
+  go.store(true,std::memory_order_release);
+  for(auto& th:threads){
     th.join();
   }
+  auto end = std::chrono::steady_clock::now();
+  logger.reset(); //异步日志器析构时等待缓冲区全部落地
+  auto drained = std::chrono::steady_clock::now();
+
+  res.wall_s = std::chrono::duration<double>(end-start).count();
+  res.drain_s = std::chrono::duration<double>(drained-start).count();
+  for(auto& h:hists) res.hist.merge(h);
+  return res;
+}
 
-  double max_cost = costs[0];
-  for(size_t i = 0; i<thr_count;i++){
-    if(costs[i]>max_cost) max_cost = costs[i];
-  }
-
-  //size_t count_ps = msg_count;
-  std::cout<<"\t总耗时:"<<max_cost<<"s"<<"\n";
-  std::cout<<"\t每秒输出条数:"<<(size_t)(msg_count/max_cost)<<"\n";
-  std::cout<<"\t每秒输出大小:"<<(size_t)(size/max_cost/1024)<<"MB"<<"\n";
-
+static void printText(std::ostream& os,const BenchResult& r){
+  const BenchConfig& c = r.conf;
+  double mb = (double)c.msg_count*c.msg_len/(1024*1024);
+  os<<"["<<c.type<<"] 线程数:"<<c.thr_count<<", 条数:"<<c.msg_count<<", 单条:"<<c.msg_len<<"B\n";
+  os<<"\t生产耗时:"<<r.wall_s<<"s, 落地耗时:"<<r.drain_s<<"s\n";
+  os<<"\t每秒输出条数:"<<(size_t)(c.msg_count/r.wall_s)<<", 每秒输出大小:"<<mb/r.wall_s<<"MB\n";
+  os<<"\t延迟(ns): p50="<<r.hist.percentile(50)<<" p99="<<r.hist.percentile(99)
+    <<" p99.9="<<r.hist.percentile(99.9)<<" max="<<r.hist.max()<<" mean="<<(uint64_t)r.hist.mean()<<"\n";
 }
 
-void sync_bench(size_t thr_count,size_t msg_count,size_t msg_len){
-  std::unique_ptr<log::LoggerBuilder> builder(new log::GlobalLoggerBuilder());
-  builder->buildLoggerName("sync_logger");
-  builder->buildLoggerType(log::LoggerType::LOGGER_SYNC);
-  //builder->buildFormatter("%m%n");
-  builder->buildSink<log::FileSink>("logs/sync.log");
-  builder->build();
-  bench("sync_logger",thr_count,msg_count,msg_len);
+static void printCsvHeader(std::ostream& os){
+  os<<"type,threads,msg_len,msg_count,wall_s,drain_s,msgs_per_s,mb_per_s,p50_ns,p99_ns,p999_ns,max_ns,mean_ns\n";
+}
+static void printCsv(std::ostream& os,const BenchResult& r){
+  const BenchConfig& c = r.conf;
+  os<<c.type<<","<<c.thr_count<<","<<c.msg_len<<","<<c.msg_count<<","
+    <<r.wall_s<<","<<r.drain_s<<","<<(size_t)(c.msg_count/r.wall_s)<<","
+    <<(double)c.msg_count*c.msg_len/(1024*1024)/r.wall_s<<","
+    <<r.hist.percentile(50)<<","<<r.hist.percentile(99)<<","<<r.hist.percentile(99.9)<<","
+    <<r.hist.max()<<","<<(uint64_t)r.hist.mean()<<"\n";
+}
+static void printJson(std::ostream& os,const BenchResult& r,bool last){
+  const BenchConfig& c = r.conf;
+  os<<"  {\"type\":\""<<c.type<<"\",\"threads\":"<<c.thr_count<<",\"msg_len\":"<<c.msg_len
+    <<",\"msg_count\":"<<c.msg_count<<",\"wall_s\":"<<r.wall_s<<",\"drain_s\":"<<r.drain_s
+    <<",\"msgs_per_s\":"<<(size_t)(c.msg_count/r.wall_s)
+    <<",\"latency_ns\":{\"p50\":"<<r.hist.percentile(50)<<",\"p99\":"<<r.hist.percentile(99)
+    <<",\"p99.9\":"<<r.hist.percentile(99.9)<<",\"max\":"<<r.hist.max()
+    <<",\"mean\":"<<(uint64_t)r.hist.mean()<<"}}"<<(last? "\n":",\n");
 }
 
-void async_bench(size_t thr_count,size_t msg_count,size_t msg_len){
-  std::unique_ptr<log::LoggerBuilder> builder(new log::GlobalLoggerBuilder());
-  builder->buildLoggerName("async_logger");
-  builder->buildLoggerType(log::LoggerType::LOGGER_ASYNC);
-  builder->buildEnableUnsafeAsync();
-  builder->buildFormatter("%m%n");
-  builder->buildSink<log::FileSink>("logs/async.log");
-  builder->build();
-  bench("async_logger",thr_count,msg_count,msg_len);
+static std::vector<std::string> split(const std::string& s){
+  std::vector<std::string> out;
+  std::stringstream ss(s);
+  std::string item;
+  while(std::getline(ss,item,',')) if(!item.empty()) out.push_back(item);
+  return out;
 }
 
-int main(){
-  std::cout<<"--------------同步测试--------------"<<std::endl;
-  //sync_bench(1,1000000,100);
-  //sync_bench(2,1000000,100);
-  sync_bench(std::thread::hardware_concurrency(),1000000,100);
-  std::cout<<"--------------异步测试--------------"<<std::endl;
-  //async_bench(1,1000000,100);
-  //async_bench(2,1000000,100);
-  async_bench(std::thread::hardware_concurrency(),1000000,100);
+int main(int argc,char* argv[]){
+  std::vector<std::string> types{"sync","sync_batch","async_safe","async_unsafe"};
+  std::vector<size_t> thr_counts{1,std::thread::hardware_concurrency()};
+  std::vector<size_t> sizes{100};
+  size_t msg_count = 1000000;
+  std::string format = "text";
+  std::string out_path;
+
+  for(int i = 1;i+1<argc;i+=2){
+    std::string key = argv[i];
+    std::string val = argv[i+1];
+    if(key=="--types") types = split(val);
+    else if(key=="--threads"){ thr_counts.clear(); for(auto& v:split(val)) thr_counts.push_back(std::strtoul(v.c_str(),nullptr,10)); }
+    else if(key=="--sizes"){ sizes.clear(); for(auto& v:split(val)) sizes.push_back(std::strtoul(v.c_str(),nullptr,10)); }
+    else if(key=="--count") msg_count = std::strtoul(val.c_str(),nullptr,10);
+    else if(key=="--format") format = val;
+    else if(key=="--out") out_path = val;
+    else { std::cout<<"未知参数: "<<key<<"\n"; return 2; }
+  }
 
+  std::ofstream ofs;
+  if(!out_path.empty()) ofs.open(out_path,std::ios::trunc);
+  std::ostream& os = out_path.empty()? std::cout:ofs;
+
+  std::vector<BenchConfig> confs;
+  for(auto& t:types)
+    for(auto thr:thr_counts)
+      for(auto sz:sizes)
+        confs.push_back(BenchConfig{t,thr==0? 1:thr,msg_count,sz});
+
+  if(format=="text") os<<"计时器开销:"<<bench::timerOverheadNs()<<"ns (已包含在延迟中)\n";
+  if(format=="csv") printCsvHeader(os);
+  if(format=="json") os<<"[\n";
+  for(size_t i = 0;i<confs.size();i++){
+    BenchResult r = runBench(confs[i]);
+    if(format=="csv") printCsv(os,r);
+    else if(format=="json") printJson(os,r,i+1==confs.size());
+    else printText(os,r);
+    os.flush();
+  }
+  if(format=="json") os<<"]\n";
   return 0;
 }
-
-
-/*
-   测试环境
-   测试方法
-   测试结果
-   */
-
-/* 测试环境:
-CPU:
-RAM:
-ROM:
-OS:
-*/
-
-/*测试方法:
-  测试方式:平均每秒能打印多少条日志到文件
-  原理:每秒打印的日志数 = 打印的日志条数/总的打印日志消耗时间
-  测试要素:同步/异步 & 单线程/多线程
-
-//其他
-- 100w条指定长度的日志输出所耗时间(耗时)
-- 每秒可以输出多少条日志     (条数)
-- 每秒可以输出多少大小的日志 (大小)
-*/
-
-//接口设计
-/*
-   输入:可控变量 = 参数 =  日志器名称, 线程数量, 日志数量, 单条日志长度, 同步/异步 ;
-   {
-   计时start
-   线程负责平均处理日志输出
-   计时end
-
-
-   输出:
-   每秒输出量 = 总条数/时间
-   每秒输出大小 = 总条数*大小/时间
-   } 
-
-//注:异步不考虑写入磁盘,只考虑写入到缓冲区(纯内存写入)
-
-*/ 
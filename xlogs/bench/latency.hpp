@@ -0,0 +1,110 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include<cstdint>
+#include<cstring>
+#include<vector>
+#include<chrono>
+
+/*
+  延迟直方图 -- 用于统计单次日志调用耗时的分布
+
+  对数-线性分桶(HdrHistogram的简化版):
+    以2的幂划分区间,每个区间再均分为SUB_BUCKETS个子桶
+    [0,64)ns 精确到1ns; 之后每个区间的相对误差不超过 1/64 ≈ 1.6%
+  记录O(1),不分配内存,每个线程独立记录,结束后合并 -- 避免多线程写共享容器的数据竞争
+*/
+
+namespace bench{
+
+  class Histogram{
+    public:
+      static const int SUB_BITS = 6;                      //子桶位数
+      static const uint64_t SUB_BUCKETS = 1ull<<SUB_BITS; //每个区间64个子桶
+      static const int RANGES = 64-SUB_BITS+1;            //覆盖全部uint64
+
+      Histogram():_counts(RANGES*SUB_BUCKETS,0),_total(0),_max(0),_min(UINT64_MAX),_sum(0){}
+
+      void record(uint64_t ns){
+        _counts[index(ns)]++;
+        _total++;
+        _sum += ns;
+        if(ns>_max) _max = ns;
+        if(ns<_min) _min = ns;
+      }
+
+      void merge(const Histogram& other){
+        for(size_t i = 0;i<_counts.size();i++) _counts[i] += other._counts[i];
+        _total += other._total;
+        _sum += other._sum;
+        if(other._max>_max) _max = other._max;
+        if(other._min<_min) _min = other._min;
+      }
+
+      //p: 0~100
+      uint64_t percentile(double p) const {
+        if(_total==0) return 0;
+        uint64_t rank = (uint64_t)(p/100.0*_total+0.5);
+        if(rank==0) rank = 1;
+        if(rank>_total) rank = _total;
+        uint64_t seen = 0;
+        for(size_t i = 0;i<_counts.size();i++){
+          seen += _counts[i];
+          if(seen>=rank){
+            uint64_t v = upperBound(i);
+            return v>_max? _max:v;
+          }
+        }
+        return _max;
+      }
+
+      uint64_t count() const { return _total; }
+      uint64_t max() const { return _max; }
+      uint64_t min() const { return _total? _min:0; }
+      double mean() const { return _total? (double)_sum/_total:0; }
+
+    private:
+      //值所在的桶下标
+      static size_t index(uint64_t v){
+        if(v<SUB_BUCKETS) return v;
+        int msb = 63-__builtin_clzll(v);            //最高位
+        int range = msb-SUB_BITS+1;                 //区间号,>=1
+        uint64_t sub = (v>>(msb-SUB_BITS))&(SUB_BUCKETS-1);
+        return range*SUB_BUCKETS+sub;
+      }
+      //桶内最大值 -- 百分位向上取整,宁可高估延迟
+      static uint64_t upperBound(size_t idx){
+        uint64_t range = idx/SUB_BUCKETS;
+        uint64_t sub = idx%SUB_BUCKETS;
+        if(range==0) return sub;
+        int shift = range-1;
+        return (((SUB_BUCKETS|sub)+1)<<shift)-1;
+      }
+
+    private:
+      std::vector<uint64_t> _counts;
+      uint64_t _total;
+      uint64_t _max;
+      uint64_t _min;
+      uint64_t _sum;
+  };
+
+  inline uint64_t nowNs(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //计时器自身开销: 连续两次取时间的最小差值,报告中给出,便于判断低延迟结果的可信度
+  inline uint64_t timerOverheadNs(){
+    uint64_t best = UINT64_MAX;
+    for(int i = 0;i<10000;i++){
+      uint64_t a = nowNs();
+      uint64_t b = nowNs();
+      if(b-a<best) best = b-a;
+    }
+    return best;
+  }
+
+} //namespace_bench_END
+
+#endif
@@ -0,0 +1,276 @@
+#include"../include/xlog.h"
+#include"../extend/my_sink.h"
+#include"alloc_counter.hpp"
+#include"latency.hpp"
+
+#include<iostream>
+#include<iomanip>
+#include<thread>
+#include<vector>
+#include<atomic>
+#include<cstdlib>
+#include<fcntl.h>
+
+/*
+  分层微基准 -- 吞吐变化时定位是哪一层造成的
+  1. Formatter::format  逐个指令类型单独计时(单项pattern),以及默认pattern整体(返回string / 追加到复用的缓冲区)
+  2. Buffer             push / swap
+  3. AsyncLooper        多线程push竞争(回调为空,只测入队)
+  4. LogSink            各落地方式对比空落地NullSink
+  5. Backtrace          低于等级的记录: 直接丢弃 / 拷入回溯环 / 正常格式化输出 对比
+  6. Payload            16KB消息体: info("%s") 与 零拷贝payload 对比(同步,空落地)
+  7. Escape             %m{escape}: 4KB消息体 直接append / 逐字节 / SSE2 / AVX2 转义吞吐
+  8. Dedup              相同记录连续输出: 不折叠 / 折叠(同步,空落地)
+
+  输出: ns/op, allocs/op(malloc次数,含operator new与vasprintf), bytes/op
+  用法: micro_bench [迭代次数=1000000]
+*/
+
+//空落地 -- 基线
+class NullSink:public log::LogSink{
+  public:
+    void log(const char* data,size_t len)override{
+      (void)data;
+      _bytes += len;
+    }
+    void logv(const struct iovec* iov,int cnt)override{
+      for(int i = 0;i<cnt;i++) _bytes += iov[i].iov_len;
+    }
+    size_t _bytes = 0;
+};
+
+static void report(const std::string& name,uint64_t ns,uint64_t ops,const bench::AllocStats& a0,const bench::AllocStats& a1){
+  std::cout<<std::left<<std::setw(36)<<name
+           <<std::right<<std::setw(10)<<std::fixed<<std::setprecision(1)<<(double)ns/ops<<" ns/op"
+           <<std::setw(10)<<std::setprecision(2)<<(double)(a1.count-a0.count)/ops<<" allocs/op"
+           <<std::setw(10)<<std::setprecision(1)<<(double)(a1.bytes-a0.bytes)/ops<<" B/op\n";
+}
+
+static volatile size_t g_sink; //防止结果被优化掉
+
+//单线程计时: fn执行iters次
+template<class Fn>
+static void run(const std::string& name,size_t iters,Fn fn){
+  for(size_t i = 0;i<iters/10;i++) fn(); //预热
+  bench::AllocStats a0 = bench::allocSnapshot();
+  uint64_t start = bench::nowNs();
+  for(size_t i = 0;i<iters;i++) fn();
+  uint64_t cost = bench::nowNs()-start;
+  bench::AllocStats a1 = bench::allocSnapshot();
+  report(name,cost,iters,a0,a1);
+}
+
+static void benchFormatter(size_t iters){
+  std::cout<<"--------------Formatter::format--------------\n";
+  log::LogMsg msg(log::LogLevel::Value::INFO,"micro_bench.cc",42,"root",std::string(100,'x'));
+  const char* patterns[][2] = {
+    {"%d{%H:%M:%S}","OP_TIME"},
+    {"%d{%H:%M:%S.%6N}","OP_TIME(us)"},
+    {"%t","OP_TID"},
+    {"%N","OP_THREAD_NAME"},
+    {"%p","OP_LEVEL"},
+    {"%p{color}","OP_LEVEL_COLOR"},
+    {"%c","OP_LOGGER"},
+    {"%f","OP_FILE"},
+    {"%l","OP_LINE"},
+    {"%m","OP_MSG"},
+    {"%n","OP_LITERAL(%n)"},
+    {"abc","OP_LITERAL"},
+    {"[%d{%H:%M:%S}][%t][%p][%c][%f:%l] %m%n","DefaultPattern"},
+  };
+  for(auto& p:patterns){
+    log::Formatter fmt(p[0]);
+    run(p[1],iters,[&](){ g_sink = fmt.format(msg).size(); });
+  }
+
+  //扩展指令: 用户自定义子项
+  struct ConstItem:public log::FormatItem{
+    void format(std::string& out,const log::LogMsg&) override{ out.append("ext",3); }
+  };
+  log::Formatter::registerItem('X',[](const std::string&){ return std::make_shared<ConstItem>(); });
+  log::Formatter ext("%X");
+  run("OP_EXTENSION",iters,[&](){ g_sink = ext.format(msg).size(); });
+
+  //日志器的用法: 追加到每线程复用的缓冲区,不分配
+  log::Formatter def;
+  std::string out;
+  run("DefaultPattern(append)",iters,[&](){ out.clear(); def.format(out,msg); g_sink = out.size(); });
+}
+
+static void benchBuffer(size_t iters){
+  std::cout<<"--------------Buffer--------------\n";
+  std::string rec(100,'x');
+  log::Buffer buf;
+  run("Buffer::push 100B",iters,[&](){
+    if(buf.writeAbleSize()<rec.size()) buf.reset(); //只测稳态写入,不测扩容
+    buf.push(rec.data(),rec.size());
+  });
+  log::Buffer other;
+  run("Buffer::swap",iters,[&](){ buf.swap(other); });
+}
+
+static void benchLooper(size_t iters){
+  std::cout<<"--------------AsyncLooper::push (unsafe,空回调)--------------\n";
+  std::string rec(100,'x');
+  size_t max_thr = std::thread::hardware_concurrency();
+  std::vector<size_t> thr_counts;
+  for(size_t thr = 1;thr<max_thr;thr*=2) thr_counts.push_back(thr);
+  thr_counts.push_back(max_thr==0? 1:max_thr); //最后一轮跑满全部核心
+  for(size_t thr:thr_counts){
+    bench::AllocStats a0,a1;
+    uint64_t cost;
+    {
+      log::AsyncLooper looper([](log::Buffer& buf){ (void)buf; },log::AsyncType::ASYNC_UNSAFE);
+      std::vector<std::thread> threads;
+      std::atomic<bool> go(false);
+      size_t per = iters/thr;
+      for(size_t i = 0;i<thr;i++){
+        threads.emplace_back([&](){
+          while(!go.load(std::memory_order_acquire)){}
+          for(size_t j = 0;j<per;j++) looper.push(rec.data(),rec.size());
+        });
+      }
+      a0 = bench::allocSnapshot();
+      uint64_t start = bench::nowNs();
+      go.store(true,std::memory_order_release);
+      for(auto& th:threads) th.join();
+      cost = bench::nowNs()-start;
+      a1 = bench::allocSnapshot();
+    }
+    report("AsyncLooper::push x"+std::to_string(thr)+" threads",cost,iters/thr*thr,a0,a1);
+  }
+}
+
+static void benchSinks(size_t iters){
+  std::cout<<"--------------LogSink::log 100B--------------\n";
+  std::string rec(99,'x');
+  rec += '\n';
+
+  NullSink null_sink;
+  run("NullSink",iters,[&](){ null_sink.log(rec.data(),rec.size()); });
+
+  //StdoutSink: 标准输出临时重定向到/dev/null; 不缓冲(每条一次write) 与 64K缓冲
+  for(size_t buffer_size:{(size_t)0,(size_t)64*1024}){
+    std::cout.flush();
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null",O_WRONLY);
+    dup2(devnull,STDOUT_FILENO);
+    uint64_t cost;
+    bench::AllocStats a0,a1;
+    {
+      log::StdoutSink sink(log::StdStream::OUT,false,buffer_size);
+      a0 = bench::allocSnapshot();
+      uint64_t start = bench::nowNs();
+      for(size_t i = 0;i<iters;i++) sink.log(rec.data(),rec.size());
+      sink.flush(false);
+      cost = bench::nowNs()-start;
+      a1 = bench::allocSnapshot();
+    }
+    dup2(saved,STDOUT_FILENO);
+    close(devnull);
+    close(saved);
+    report(buffer_size? "StdoutSink(/dev/null,64K buffer)":"StdoutSink(/dev/null)",cost,iters,a0,a1);
+  }
+
+  log::FileSink file_sink("logs/micro/file.log");
+  run("FileSink",iters,[&](){ file_sink.log(rec.data(),rec.size()); });
+
+  log::RollBySizeSink size_sink("logs/micro/size-",64*1024*1024);
+  run("RollBySizeSink(64M)",iters,[&](){ size_sink.log(rec.data(),rec.size()); });
+
+  RollbyTimeSink time_sink("logs/micro/time-",TimeGap::HOUR);
+  run("RollbyTimeSink(HOUR)",iters,[&](){ time_sink.log(rec.data(),rec.size()); });
+}
+
+static void benchBacktrace(size_t iters){
+  std::cout<<"--------------Backtrace (INFO级日志器)--------------\n";
+  auto build = [](const std::string& name,size_t ring){
+    std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+    builder->buildLoggerName(name);
+    builder->buildLoggerLevel(log::LogLevel::Value::INFO);
+    builder->buildBacktrace(ring);
+    builder->buildSink<NullSink>();
+    return builder->build();
+  };
+  log::Logger::s_ptr plain = build("bt_plain",0);
+  log::Logger::s_ptr ring = build("bt_ring",1024);
+  run("debug() 丢弃",iters,[&](){ plain->debug("request %d from %s took %.3f ms",42,"10.0.0.1",1.25); });
+  run("debug() 拷入回溯环",iters,[&](){ ring->debug("request %d from %s took %.3f ms",42,"10.0.0.1",1.25); });
+  run("info() 格式化+落地",iters,[&](){ plain->info("request %d from %s took %.3f ms",42,"10.0.0.1",1.25); });
+}
+
+static void benchPayload(size_t iters){
+  std::cout<<"--------------Payload 16KB (同步,空落地)--------------\n";
+  std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+  builder->buildLoggerName("payload");
+  builder->buildSink<NullSink>();
+  log::Logger::s_ptr logger = builder->build();
+  std::string big(16*1024,'x');
+  iters = iters/10+1;
+  run("info(\"%s\")",iters,[&](){ logger->info("%s",big.c_str()); });
+  run("payload()",iters,[&](){ logger->payload(log::LogLevel::Value::INFO,big.data(),big.size()); });
+}
+
+static void benchDedup(size_t iters){
+  std::cout<<"--------------Dedup (同步,空落地)--------------\n";
+  for(int d = 0;d<2;d++){
+    std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+    builder->buildLoggerName(d? "dedup":"nodedup");
+    builder->buildSink<NullSink>();
+    if(d) builder->buildDedup(1000);
+    log::Logger::s_ptr logger = builder->build();
+    run(d? "info 重复(折叠)":"info 重复(不折叠)",iters,[&](){ logger->info("connect failed: %d",111); });
+  }
+}
+
+static void benchEscape(size_t iters){
+  std::cout<<"--------------Escape 4KB (%m{escape})--------------\n";
+  std::string clean(4096,'x');
+  for(size_t i = 0;i<clean.size();i+=7) clean[i] = 'a'+i%26;
+  std::string dirty = clean;
+  for(size_t i = 50;i<dirty.size();i+=100) dirty[i] = '\n'; //每100字节一个换行
+  std::string out;
+  out.reserve(8192);
+  iters = iters/10+1;
+  auto gbps = [&](const std::string& name,const std::string& in,log::escape::FindFn find){
+    uint64_t start = bench::nowNs();
+    for(size_t i = 0;i<iters;i++){
+      out.clear();
+      if(find) log::escape::append(out,in.data(),in.size(),find);
+      else out.append(in);
+      g_sink = out.size();
+    }
+    uint64_t cost = bench::nowNs()-start;
+    std::cout<<std::left<<std::setw(36)<<name<<std::right<<std::fixed<<std::setw(10)<<std::setprecision(2)
+             <<(double)in.size()*iters/cost<<" GB/s\n";
+  };
+  gbps("append(不转义)",clean,nullptr);
+  for(int d = 0;d<2;d++){
+    const std::string& in = d? dirty:clean;
+    std::string tag = d? " 每100B一个换行":" 无控制字符";
+    gbps("scalar"+tag,in,log::escape::findControlScalar);
+#if defined(__SSE2__)
+    gbps("SSE2"+tag,in,log::escape::findControlSse2);
+#endif
+#if defined(XLOG_ESCAPE_AVX2)
+    if(__builtin_cpu_supports("avx2")) gbps("AVX2"+tag,in,log::escape::findControlAvx2);
+#endif
+  }
+  log::Formatter plain("%m%n"),esc("%m{escape}%n");
+  log::LogMsg msg(log::LogLevel::Value::INFO,"micro_bench.cc",42,"root",clean);
+  run("Formatter %m%n 4KB",iters,[&](){ out.clear(); plain.format(out,msg); g_sink = out.size(); });
+  run("Formatter %m{escape}%n 4KB",iters,[&](){ out.clear(); esc.format(out,msg); g_sink = out.size(); });
+}
+
+int main(int argc,char* argv[]){
+  size_t iters = argc>1? std::strtoul(argv[1],nullptr,10):1000000;
+  benchFormatter(iters);
+  benchBuffer(iters);
+  benchLooper(iters);
+  benchSinks(iters);
+  benchBacktrace(iters);
+  benchPayload(iters);
+  benchEscape(iters);
+  benchDedup(iters);
+  return 0;
+}
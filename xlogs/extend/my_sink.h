@@ -3,6 +3,7 @@
 
 #include<iostream>
 #include<string>
+#include<vector>
 #include"../include/util.hpp"
 #include"../include/sink.hpp"
 #include<ctime>
@@ -17,42 +18,36 @@ enum class TimeGap{
   DAY
 };
 
+/*
+  按时间滚动,滚动窗口与日历对齐: HOUR在整点,DAY在本地零点切换,与启动时间无关
+  下一次切换的时间点(deadline)只在切换时计算一次(mktime处理跨月,夏令时等),
+  每次写入只需一次粗粒度取时间+比较,没有除法与localtime
+
+  policy: 可选的保留策略,如 RetentionPolicy(24*7) 只保留最近7天的小时文件
+*/
 class RollbyTimeSink :public log::LogSink {
   public:
-    RollbyTimeSink(std::string basename,TimeGap timegap)
-      :_basename(basename),_start_timestamp(log::util::DateUtil::getCurTime())
+    RollbyTimeSink(std::string basename,TimeGap timegap,const log::RetentionPolicy& policy = log::RetentionPolicy())
+      :_basename(basename),_gap(timegap),_cur_fsize(0)
     {
-      switch(timegap){
-        case TimeGap::SECOND:_gap_size = 1;break;
-        case TimeGap::MINUTE:_gap_size = 60;break;
-        case TimeGap::HOUR:_gap_size=3600;break;
-        case TimeGap::DAY:_gap_size=3600*24;break;
-      }
       log::util::FileUtil::createDirectory(log::util::FileUtil::getPath(_basename));
-      std::string filename = createNewFileName();
-      _ofs.open(filename,std::ios::binary|std::ios::app);
-      if(!_ofs.is_open()){
-        std::cout<<"RollbyTimeSink:文件打开失败"<<"\n";
-        abort();
+      if(policy.enabled()){
+        _retention = std::make_shared<log::RetentionManager>(_basename,policy);
       }
-      _cur_gap = (log::util::DateUtil::getCurTime()-_start_timestamp)/_gap_size;
+      openWindow(log::util::DateUtil::getCurTime());
     }
 
 
     void log(const char* data,size_t len)override{
-      size_t new_gap = (log::util::DateUtil::getCurTime() - _start_timestamp)/_gap_size;
-
-      if(new_gap>_cur_gap){
+      time_t now = log::util::DateUtil::getCoarseTime();
+      if(now>=_deadline){
         _ofs.close();
-        log::util::FileUtil::createDirectory(log::util::FileUtil::getPath(_basename));
-        std::string filename = createNewFileName();
-        _ofs.open(filename,std::ios::binary|std::ios::app);
-        if(!_ofs.is_open()){
-          std::cout<<"RollbyTimeSink:文件打开失败"<<"\n";
-          abort();
-        }
+        _unsynced.push_back(_cur_name);
+        if(_unsynced.size()>64) _unsynced.erase(_unsynced.begin()); //很久以前的窗口文件早已被内核回写
+        openWindow(now);
       }
       _ofs.write(data,len);
+      _cur_fsize += len;
       if(!_ofs.good()){
         std::cout<<"RollbyTimeSink:log():文件写入异常"<<"\n";
         abort();
@@ -60,31 +55,73 @@ class RollbyTimeSink :public log::LogSink {
 
     }
 
+    void flush(bool fsync)override{
+      _ofs.flush();
+      if(!fsync) return;
+      for(auto& name:_unsynced) log::util::FileUtil::syncFile(name);
+      _unsynced.clear();
+      log::util::FileUtil::syncFile(_cur_name);
+    }
+
   private:
-    std::string createNewFileName(){
-      //根据当前时间构建 // ./logs/base-20230102030507.log
-      time_t timestamp = log::util::DateUtil::getCurTime();
-      struct tm tm; //或者命名lt:localtime
-      localtime_r(&timestamp,&tm);
+    //打开now所在窗口的文件,并计算下一次切换时间
+    void openWindow(time_t now){
+      time_t start = windowStart(now);
+      _deadline = nextWindow(start);
+      log::util::FileUtil::createDirectory(log::util::FileUtil::getPath(_basename));
+      std::string filename = createNewFileName(start);
+      _ofs.open(filename,std::ios::binary|std::ios::app);
+      if(!_ofs.is_open()){
+        std::cout<<"RollbyTimeSink:文件打开失败"<<"\n";
+        abort();
+      }
+      _cur_name = filename;
+      if(_retention) _retention->segmentOpened(filename,_cur_fsize);
+      _cur_fsize = 0;
+    }
 
-      std::stringstream ss;//自动类型推导特性
-      ss<<_basename;
-      ss<<tm.tm_year+1900;
-      ss<<tm.tm_mon+1;
-      ss<<tm.tm_mday;
-      ss<<tm.tm_hour;
-      ss<<tm.tm_min;
-      ss<<tm.tm_sec;
-      ss<<".log";
+    //窗口起点: 对齐到本地时间的整秒/整分/整点/零点
+    time_t windowStart(time_t now){
+      struct tm tm;
+      localtime_r(&now,&tm);
+      //粒度越粗,清零的字段越多
+      if(_gap==TimeGap::DAY) tm.tm_hour = 0;
+      if(_gap==TimeGap::DAY || _gap==TimeGap::HOUR) tm.tm_min = 0;
+      if(_gap!=TimeGap::SECOND) tm.tm_sec = 0;
+      tm.tm_isdst = -1; //由mktime判断夏令时
+      return mktime(&tm);
+    }
 
-      return ss.str();
+    time_t nextWindow(time_t start){
+      struct tm tm;
+      localtime_r(&start,&tm);
+      switch(_gap){
+        case TimeGap::SECOND: tm.tm_sec += 1;break;
+        case TimeGap::MINUTE: tm.tm_min += 1;break;
+        case TimeGap::HOUR: tm.tm_hour += 1;break;
+        case TimeGap::DAY: tm.tm_mday += 1;break;
+      }
+      tm.tm_isdst = -1;
+      return mktime(&tm); //越界字段由mktime归一化
+    }
+
+    std::string createNewFileName(time_t start){
+      //以窗口起点命名,定长补零 // ./logs/base-20230102030000.log
+      struct tm tm; //或者命名lt:localtime
+      localtime_r(&start,&tm);
+      char tmp[32] = {0};
+      strftime(tmp,sizeof(tmp),"%Y%m%d%H%M%S",&tm);
+      return _basename+tmp+".log";
     }
   private:
     std::string _basename;//基础名
     std::ofstream _ofs;   //写入文件
-    size_t _gap_size;     //时间间隔大小/周期period
-    size_t _cur_gap;      //当前是第几个间隔
-    time_t _start_timestamp; //起始时间
+    std::string _cur_name;                //当前文件名
+    std::vector<std::string> _unsynced;   //上次落盘后切换出去的文件名
+    TimeGap _gap;         //时间间隔/周期period
+    time_t _deadline;     //当前窗口结束时间,到达即切换
+    size_t _cur_fsize;    //当前文件已写入大小,切换时告知保留策略
+    log::RetentionManager::s_ptr _retention; //保留策略,未设置时为空
 
 };
 
@@ -0,0 +1,96 @@
+#ifndef ALLOC_TRACE_HPP
+#define ALLOC_TRACE_HPP
+
+#include<atomic>
+#include<cstdint>
+#include<cstddef>
+
+/*
+  堆分配归因 -- 定义XLOG_ALLOC_TRACE启用(仅用于基准/排查构建)
+  日志路径上的各阶段用XLOG_ALLOC_SCOPE标记,分配发生时按当前线程所处阶段计数:
+    VASPRINTF  不定参格式化
+    LOGMSG     LogMsg构造(文件名,日志器名,消息体拷贝)
+    FORMAT     Formatter::format
+    BUFFER     Buffer扩容
+    SINK       交给落地/入队,以及落地内部
+    OTHER      不在以上阶段中
+  本头文件只负责记账,不替换分配器: 由使用方(bench的分配钩子)在每次分配时调用record()
+  未定义XLOG_ALLOC_TRACE时XLOG_ALLOC_SCOPE为空,不产生任何代码
+  阶段可嵌套,内层优先(如SINK中的Buffer扩容记为BUFFER)
+*/
+
+namespace log{
+  namespace alloctrace{
+
+    enum Phase{
+      OTHER = 0,
+      VASPRINTF,
+      LOGMSG,
+      FORMAT,
+      BUFFER,
+      SINK,
+      PHASE_COUNT
+    };
+
+    inline const char* phaseName(int phase){
+      static const char* names[PHASE_COUNT] = {"other","vasprintf","LogMsg","format","buffer","sink"};
+      return phase>=0 && phase<PHASE_COUNT? names[phase]:"unknown";
+    }
+
+    //分配钩子中调用: 计数只用原子与线程局部的POD,自身不会分配
+    inline int& currentPhase(){
+      static thread_local int phase = OTHER;
+      return phase;
+    }
+    inline std::atomic<uint64_t>* phaseCounts(){
+      static std::atomic<uint64_t> counts[PHASE_COUNT];
+      return counts;
+    }
+    inline std::atomic<uint64_t>* phaseBytes(){
+      static std::atomic<uint64_t> bytes[PHASE_COUNT];
+      return bytes;
+    }
+
+    inline void record(size_t size){
+      int phase = currentPhase();
+      phaseCounts()[phase].fetch_add(1,std::memory_order_relaxed);
+      phaseBytes()[phase].fetch_add(size,std::memory_order_relaxed);
+    }
+
+    struct PhaseStats{
+      uint64_t count[PHASE_COUNT];
+      uint64_t bytes[PHASE_COUNT];
+    };
+
+    inline PhaseStats snapshot(){
+      PhaseStats s;
+      for(int i = 0;i<PHASE_COUNT;i++){
+        s.count[i] = phaseCounts()[i].load(std::memory_order_relaxed);
+        s.bytes[i] = phaseBytes()[i].load(std::memory_order_relaxed);
+      }
+      return s;
+    }
+
+    class Scope{
+      public:
+        explicit Scope(Phase phase):_prev(currentPhase()){ currentPhase() = phase; }
+        ~Scope(){ currentPhase() = _prev; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+      private:
+        int _prev;
+    };
+
+  } //namespace_alloctrace_END
+} //namespace_log_END
+
+#ifdef XLOG_ALLOC_TRACE
+  #define XLOG_ALLOC_CONCAT_(a,b) a##b
+  #define XLOG_ALLOC_NAME_(line) XLOG_ALLOC_CONCAT_(_xlog_alloc_scope_,line)
+  //按行号命名,同一作用域内可以依次标记多个阶段(后者覆盖前者)
+  #define XLOG_ALLOC_SCOPE(phase) log::alloctrace::Scope XLOG_ALLOC_NAME_(__LINE__)(log::alloctrace::phase)
+#else
+  #define XLOG_ALLOC_SCOPE(phase)
+#endif
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef BACKTRACE_HPP
+#define BACKTRACE_HPP
+
+#include<string>
+#include<vector>
+#include<atomic>
+#include<mutex>
+#include<algorithm>
+#include<cstdarg>
+#include<cstdio>
+#include<cstring>
+#include<cstdint>
+#include<cstddef>
+#include<cerrno>
+#include<type_traits>
+
+#include"level.hpp"
+#include"message.hpp"
+#include"util.hpp"
+
+/*
+  回溯环 -- 低于日志器等级的记录不格式化,不落地,只把原始参数拷入内存环
+  等到ERROR/FATAL通过等级过滤时,先把环中的记录格式化并输出,再输出这条错误
+  生产环境以INFO运行,出错时仍能看到之前的DEBUG上下文,平时的代价只是一次memcpy
+
+  参数捕获: 按printf格式串解析每个转换说明的类型,va_arg取出后原样存入定长槽位
+            字符串参数拷贝内容(指定精度时最多拷贝精度字节,与printf一样不要求'\0'结尾); 回放时按同一格式串逐段snprintf
+            %m在写入时保存errno,回放时输出对应的strerror文本(回放时的errno已无意义)
+            宽字符(%ls,%lc),格式串,参数超出槽位容量时退化为直接vsnprintf(截断)
+  并发: 每个日志器一个环,写入者fetch_add取得位置后CAS占用槽位(槽位正被写入则丢弃本条),不加锁
+        输出时按位置顺序读取,读前后比对槽位状态(seqlock),被覆盖的槽位跳过
+*/
+
+namespace log{
+
+  class ArgCapture{
+    public:
+      static const int PREC_STAR = -2;
+
+      //转换说明: %[flags][width][.precision][length]conv
+      struct Spec{
+        const char* begin; //'%'
+        const char* end;   //conv之后
+        int stars;         //*宽度/精度的个数
+        int prec;          //精度: -1未指定, PREC_STAR由参数给出
+        char conv;
+        char len;          //'h','H'(hh),'l','q'(ll),'j','z','t','L',0
+      };
+
+      //解析p处('%'之后)的转换说明; 返回false表示格式串不完整
+      static bool parse(const char* pct,Spec& spec){
+        const char* p = pct+1;
+        spec.begin = pct;
+        spec.stars = 0;
+        spec.prec = -1;
+        spec.len = 0;
+        while(*p && strchr("-+ #0'",*p)) p++;
+        if(*p=='*'){ spec.stars++; p++; }
+        while(*p>='0' && *p<='9') p++;
+        if(*p=='.'){
+          p++;
+          spec.prec = 0;
+          if(*p=='*'){ spec.stars++; spec.prec = PREC_STAR; p++; }
+          while(*p>='0' && *p<='9') spec.prec = spec.prec*10+(*p++ -'0');
+        }
+        switch(*p){
+          case 'h': p++; spec.len = 'h'; if(*p=='h'){ p++; spec.len = 'H'; } break;
+          case 'l': p++; spec.len = 'l'; if(*p=='l'){ p++; spec.len = 'q'; } break;
+          case 'q': case 'j': case 'z': case 't': case 'L': spec.len = *p++; break;
+        }
+        if(*p=='\0') return false;
+        spec.conv = *p++;
+        spec.end = p;
+        return true;
+      }
+
+      //按格式串取出参数写入out; err为调用日志接口时的errno(供%m使用); 空间不足或遇到不支持的说明返回false
+      static bool capture(const char* fmt,va_list* ap,int err,char* out,size_t cap,size_t& used){
+        used = 0;
+        for(const char* p = fmt;(p = strchr(p,'%'))!=nullptr;){
+          if(p[1]=='%'){ p += 2; continue; }
+          Spec spec;
+          if(!parse(p,spec)) return false;
+          int star = 0;
+          for(int i = 0;i<spec.stars;i++){
+            star = va_arg(*ap,int);
+            if(!put<int64_t>(star,out,cap,used)) return false;
+          }
+          //精度为*时是最后一个*参数; 负数等同未指定
+          int prec = spec.prec==PREC_STAR? (star<0? -1:star):spec.prec;
+          //%ls,%lc为宽字符,交给vsnprintf
+          if(spec.len=='l' && (spec.conv=='s' || spec.conv=='c')) return false;
+          switch(spec.conv){
+            case 'd': case 'i':
+              if(!put<int64_t>(signedArg(ap,spec.len),out,cap,used)) return false;
+              break;
+            case 'u': case 'o': case 'x': case 'X': case 'c':
+              if(!put<uint64_t>(unsignedArg(ap,spec.len),out,cap,used)) return false;
+              break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+              if(spec.len=='L'){
+                if(!put<long double>(va_arg(*ap,long double),out,cap,used)) return false;
+              }
+              else if(!put<double>(va_arg(*ap,double),out,cap,used)) return false;
+              break;
+            case 'p':
+              if(!put<const void*>(va_arg(*ap,const void*),out,cap,used)) return false;
+              break;
+            case 's':{
+              const char* s = va_arg(*ap,const char*);
+              if(s==nullptr) s = "(null)";
+              //指定精度时字符串不要求以'\0'结尾,最多读取prec字节
+              size_t n = prec>=0? strnlen(s,prec):strlen(s);
+              if(!put<uint32_t>((uint32_t)n,out,cap,used) || used+n>cap) return false;
+              memcpy(out+used,s,n);
+              used += n;
+              break;
+            }
+            case 'n':
+              (void)va_arg(*ap,void*);
+              break;
+            case 'm':
+              if(!put<int32_t>(err,out,cap,used)) return false;
+              break;
+            default:
+              return false; //%ls等宽字符不支持
+          }
+          p = spec.end;
+        }
+        return true;
+      }
+
+      //按格式串与捕获的参数重新格式化
+      static std::string replay(const char* fmt,const char* args,size_t len){
+        std::string out;
+        size_t off = 0;
+        const char* p = fmt;
+        while(true){
+          const char* pct = strchr(p,'%');
+          if(pct==nullptr){ out.append(p); break; }
+          out.append(p,pct-p);
+          if(pct[1]=='%'){ out += '%'; p = pct+2; continue; }
+          Spec spec;
+          if(!parse(pct,spec)){ out.append(pct); break; }
+          std::string piece(spec.begin,spec.end);
+          int stars[2] = {0,0};
+          for(int i = 0;i<spec.stars;i++) stars[i] = (int)get<int64_t>(args,len,off);
+          switch(spec.conv){
+            case 'd': case 'i':
+              one(out,piece,spec,stars,(long long)get<int64_t>(args,len,off),spec.len); break;
+            case 'u': case 'o': case 'x': case 'X': case 'c':
+              one(out,piece,spec,stars,(unsigned long long)get<uint64_t>(args,len,off),spec.len); break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+              if(spec.len=='L') emit(out,piece.c_str(),spec.stars,stars,get<long double>(args,len,off));
+              else emit(out,piece.c_str(),spec.stars,stars,get<double>(args,len,off));
+              break;
+            case 'p':
+              emit(out,piece.c_str(),spec.stars,stars,get<const void*>(args,len,off)); break;
+            case 's':{
+              uint32_t n = get<uint32_t>(args,len,off);
+              n = off<len? (uint32_t)std::min<size_t>(n,len-off):0;
+              std::string s(args+off,n);
+              off += n;
+              emit(out,piece.c_str(),spec.stars,stars,s.c_str());
+              break;
+            }
+            case 'm':{
+              //按写入时的errno输出,宽度/对齐等修饰沿用原说明
+              piece.back() = 's';
+              emit(out,piece.c_str(),spec.stars,stars,strerror(get<int32_t>(args,len,off)));
+              break;
+            }
+            default:
+              break; //%n不输出
+          }
+          p = spec.end;
+        }
+        return out;
+      }
+
+    private:
+      static long long signedArg(va_list* ap,char len){
+        switch(len){
+          case 'l': return va_arg(*ap,long);
+          case 'q': return va_arg(*ap,long long);
+          case 'j': return va_arg(*ap,intmax_t);
+          case 'z': return va_arg(*ap,ssize_t);
+          case 't': return va_arg(*ap,ptrdiff_t);
+          default: return va_arg(*ap,int);
+        }
+      }
+      static unsigned long long unsignedArg(va_list* ap,char len){
+        switch(len){
+          case 'l': return va_arg(*ap,unsigned long);
+          case 'q': return va_arg(*ap,unsigned long long);
+          case 'j': return va_arg(*ap,uintmax_t);
+          case 'z': return va_arg(*ap,size_t);
+          case 't': return va_arg(*ap,ptrdiff_t);
+          default: return va_arg(*ap,unsigned int);
+        }
+      }
+
+      template<class T>
+      static bool put(T v,char* out,size_t cap,size_t& used){
+        if(used+sizeof(T)>cap) return false;
+        memcpy(out+used,&v,sizeof(T));
+        used += sizeof(T);
+        return true;
+      }
+      template<class T>
+      static T get(const char* args,size_t len,size_t& off){
+        T v = T();
+        if(off+sizeof(T)<=len) memcpy(&v,args+off,sizeof(T));
+        off += sizeof(T);
+        return v;
+      }
+
+      //整数按原长度修饰符还原类型后输出
+      template<class T>
+      static void one(std::string& out,const std::string& piece,const Spec& spec,const int* stars,T v,char len){
+        const char* f = piece.c_str();
+        switch(len){
+          case 'l': emit(out,f,spec.stars,stars,(typename std::conditional<std::is_signed<T>::value,long,unsigned long>::type)v); break;
+          case 'q': emit(out,f,spec.stars,stars,v); break;
+          case 'j': emit(out,f,spec.stars,stars,(typename std::conditional<std::is_signed<T>::value,intmax_t,uintmax_t>::type)v); break;
+          case 'z': emit(out,f,spec.stars,stars,(typename std::conditional<std::is_signed<T>::value,ssize_t,size_t>::type)v); break;
+          case 't': emit(out,f,spec.stars,stars,(ptrdiff_t)v); break;
+          default: emit(out,f,spec.stars,stars,(typename std::conditional<std::is_signed<T>::value,int,unsigned int>::type)v); break;
+        }
+      }
+
+      template<class T>
+      static void emit(std::string& out,const char* f,int nstars,const int* stars,T v){
+        char buf[512];
+        int n;
+        if(nstars==2) n = snprintf(buf,sizeof(buf),f,stars[0],stars[1],v);
+        else if(nstars==1) n = snprintf(buf,sizeof(buf),f,stars[0],v);
+        else n = snprintf(buf,sizeof(buf),f,v);
+        if(n<0) return;
+        if((size_t)n<sizeof(buf)){ out.append(buf,n); return; }
+        std::string big(n+1,'\0');
+        if(nstars==2) snprintf(&big[0],big.size(),f,stars[0],stars[1],v);
+        else if(nstars==1) snprintf(&big[0],big.size(),f,stars[0],v);
+        else snprintf(&big[0],big.size(),f,v);
+        out.append(big.data(),n);
+      }
+  };
+
+  class BacktraceRing{
+    public:
+      static const size_t SLOT_DATA = 320; //每个槽位: 文件名+格式串+参数
+
+      explicit BacktraceRing(size_t n):_slots(n==0? 1:n),_pos(0),_dumped(0){}
+
+      //记录一条未通过等级过滤的日志: 不格式化,只拷贝
+      void push(LogLevel::Value level,const char* file,size_t line,const char* fmt,va_list ap){
+        int err = errno; //%m使用调用时的errno,先于其他调用保存
+        uint64_t pos = _pos.fetch_add(1,std::memory_order_relaxed);
+        Slot& slot = _slots[pos%_slots.size()];
+        uint64_t st = slot.state.load(std::memory_order_acquire);
+        if((st&1) || !slot.state.compare_exchange_strong(st,1,std::memory_order_acquire)) return; //槽位正被写入,丢弃
+
+        slot.time_ns = util::DateUtil::getCurTimeNs();
+        slot.level = level;
+        slot.line = (uint32_t)line;
+        const util::ThreadInfo& ti = util::ThreadUtil::current();
+        slot.tid_len = (uint8_t)std::min(ti.tid_len,sizeof(slot.tid));
+        memcpy(slot.tid,ti.tid,slot.tid_len);
+        slot.name_len = (uint8_t)std::min(ti.name.size(),sizeof(slot.name));
+        memcpy(slot.name,ti.name.data(),slot.name_len);
+
+        //文件名过长时保留结尾部分
+        size_t fsize = strlen(file);
+        size_t flen = std::min<size_t>(fsize,64);
+        memcpy(slot.data,file+fsize-flen,flen);
+        slot.file_len = (uint16_t)flen;
+
+        size_t off = flen;
+        size_t fmt_len = strlen(fmt)+1;
+        size_t used = 0;
+        va_list cp;
+        va_copy(cp,ap);
+        bool ok = off+fmt_len<SLOT_DATA && ArgCapture::capture(fmt,&cp,err,slot.data+off+fmt_len,SLOT_DATA-off-fmt_len,used);
+        va_end(cp);
+        if(ok){
+          memcpy(slot.data+off,fmt,fmt_len);
+          slot.fmt_len = (uint16_t)fmt_len;
+          slot.used = (uint16_t)(off+fmt_len+used);
+          slot.preformatted = false;
+        }
+        else{ //退化: 直接格式化,超出部分截断
+          va_copy(cp,ap);
+          errno = err;
+          int n = vsnprintf(slot.data+off,SLOT_DATA-off,fmt,cp);
+          va_end(cp);
+          slot.fmt_len = 0;
+          slot.used = (uint16_t)(off+std::min<size_t>(n<0? 0:n,SLOT_DATA-off-1));
+          slot.preformatted = true;
+        }
+        slot.state.store(2*(pos+1),std::memory_order_release);
+      }
+
+      //按写入顺序回放上次输出之后的记录; fn(LogMsg&)
+      template<class Fn>
+      void dump(const std::string& logger_name,Fn fn){
+        std::unique_lock<std::mutex> lock(_dump_mutex);
+        uint64_t cur = _pos.load(std::memory_order_acquire);
+        uint64_t from = std::max<uint64_t>(_dumped,cur>_slots.size()? cur-_slots.size():0);
+        _dumped = cur;
+        Slot copy;
+        for(uint64_t p = from;p<cur;p++){
+          Slot& slot = _slots[p%_slots.size()];
+          uint64_t s1 = slot.state.load(std::memory_order_acquire);
+          if(s1!=2*(p+1)) continue; //未写完或已被覆盖
+          copy.copyFrom(slot);
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if(slot.state.load(std::memory_order_relaxed)!=s1) continue;
+
+          std::string file(copy.data,copy.file_len);
+          std::string payload = copy.preformatted
+            ? std::string(copy.data+copy.file_len,copy.used-copy.file_len)
+            : ArgCapture::replay(copy.data+copy.file_len,copy.data+copy.file_len+copy.fmt_len,copy.used-copy.file_len-copy.fmt_len);
+          util::ThreadInfo ti;
+          memcpy(ti.tid,copy.tid,copy.tid_len);
+          ti.tid_len = copy.tid_len;
+          ti.name.assign(copy.name,copy.name_len);
+
+          LogMsg msg(copy.level,file.c_str(),copy.line,logger_name.c_str(),payload);
+          msg._time_ns = copy.time_ns;
+          msg._time = copy.time_ns/1000000000ull;
+          msg._thread = &ti;
+          fn(msg);
+        }
+      }
+
+    private:
+      struct Slot{
+        std::atomic<uint64_t> state;  //0:空 1:写入中 2*(pos+1):已写入位置pos
+        uint64_t time_ns;
+        uint32_t line;
+        LogLevel::Value level;
+        bool preformatted;            //data中是已格式化的消息
+        uint16_t file_len;
+        uint16_t fmt_len;             //含结尾'\0'
+        uint16_t used;
+        uint8_t tid_len;
+        uint8_t name_len;
+        char tid[24];
+        char name[16];
+        char data[SLOT_DATA];         //[文件名][格式串\0][参数] 或 [文件名][消息]
+
+        Slot():state(0){}
+        void copyFrom(const Slot& o){
+          time_ns = o.time_ns; line = o.line; level = o.level; preformatted = o.preformatted;
+          file_len = o.file_len; fmt_len = o.fmt_len; used = std::min<uint16_t>(o.used,SLOT_DATA);
+          tid_len = std::min<uint8_t>(o.tid_len,sizeof(tid)); name_len = std::min<uint8_t>(o.name_len,sizeof(name));
+          memcpy(tid,o.tid,tid_len);
+          memcpy(name,o.name,name_len);
+          memcpy(data,o.data,used);
+        }
+      };
+
+      std::vector<Slot> _slots;
+      std::atomic<uint64_t> _pos;   //下一个写入位置
+      std::mutex _dump_mutex;
+      uint64_t _dumped;             //已输出到的位置,在_dump_mutex内访问
+  };
+
+} //namespace_log_END
+
+#endif
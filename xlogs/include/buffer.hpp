@@ -4,6 +4,7 @@
 #include<iostream>
 #include<vector>
 #include<cassert>
+#include"alloc_trace.hpp"
 
 
 //同步写日志过程(直接落地)可能写的比较慢,写入量多等,为了避免因写日志过程阻塞带来的影响,实现异步落地日志器
@@ -63,8 +64,8 @@ namespace log{
                                            
     class Buffer{
     public:
-        Buffer()
-        :_buffer(DEFAULT_BUFFER_SIZE),_rindex(0),_windex(0)
+        explicit Buffer(size_t size = DEFAULT_BUFFER_SIZE)
+        :_buffer(size),_rindex(0),_windex(0)
         {} 
 
         void push(const char* data,size_t len){
@@ -122,6 +123,7 @@ namespace log{
         //扩容 -- 确保有足够空间
         void ensureEnoughSize(size_t len){ //简单复现 -- linux 网络IO 拥塞控制
           if (len <= writeAbleSize()) return;
+          XLOG_ALLOC_SCOPE(BUFFER);
           size_t new_capacity = 0;
           if (_buffer.size() < THRESHOLD_BUFFER_SIZE) {
             new_capacity = _buffer.size() * 2 + len;
@@ -0,0 +1,135 @@
+#ifndef DEDUP_HPP
+#define DEDUP_HPP
+
+#include<string>
+#include<mutex>
+#include<cstring>
+#include<cstdint>
+#include<cstddef>
+
+#include"level.hpp"
+#include"metrics.hpp"
+#include"util.hpp"
+
+/*
+  重复消息折叠 -- 崩溃循环,重试风暴时同一行日志每秒成千上万条,折叠后只输出一次
+  按(调用点: 文件,行号,等级 + 消息体)计算哈希,与同一日志器的上一条记录比较:
+    相同且在时间窗口内  不输出,只计数
+    不同,或窗口已过     先输出一条汇总 "last message repeated N times"(等级,文件,行号沿用被折叠的记录),
+                        再正常输出本条,并重新开始计时
+  风暴期间每个窗口最多输出两行(原消息+汇总)
+  只比较相邻记录: 两种消息交替出现时不折叠
+  汇总还会在flush()与日志器析构时输出,风暴结束后没有新日志也不会丢失计数
+  汇总在锁内生成,由调用方在释放锁后输出: 输出可能经过异步缓冲区阻塞,不能让其他生产者等在折叠锁上
+    代价: 多线程同时写同一日志器时,其他线程的记录可能插在汇总与本条之间
+  时间窗口用粗粒度单调时钟(精度一个时钟节拍),窗口边界有几毫秒误差
+
+  折叠发生在格式化之前: 格式化后的行带时间戳,已无法比较
+  先比较64位哈希(按8字节分块的FNV式乘法混合)过滤,哈希相同时再逐字节比较调用点与消息体,
+  哈希碰撞不会把不同的记录当作重复丢弃; 为此保存上一条记录的消息体(复用容量,稳定后不分配)
+*/
+
+namespace log{
+
+  //待输出的汇总; 调用方每线程复用一个,稳定后不分配
+  struct DupSummary{
+    bool pending = false;
+    LogLevel::Value level = LogLevel::Value::DEBUG;
+    std::string file;
+    size_t line = 0;
+    std::string text;
+  };
+
+  class DupFilter{
+    public:
+      explicit DupFilter(uint64_t window_ms)
+        :_window_ns(window_ms*1000000ull),_valid(false),_hash(0),_level(LogLevel::Value::DEBUG),_line(0),_count(0),_since(0){}
+
+      //返回true表示本条被折叠,调用方不再输出
+      //返回false时若summary.pending,调用方须先输出汇总再输出本条
+      bool suppress(LogLevel::Value level,const char* file,size_t line,const char* data,size_t len,DupSummary& summary){
+        uint64_t h = hash(level,file,line,data,len);
+        uint64_t now = util::DateUtil::getCoarseSteadyNs();
+        std::unique_lock<std::mutex> lock(_mutex);
+        if(_valid && h==_hash && now-_since<_window_ns && same(level,file,line,data,len)){
+          _count++;
+          _suppressed.add();
+          return true;
+        }
+        emitSummary(summary);
+        _valid = true;
+        _hash = h;
+        _level = level;
+        _file = file; //复用已有容量,同一调用点反复出现时不分配
+        _line = line;
+        _body.assign(data,len);
+        _since = now;
+        return false;
+      }
+
+      //取出尚未输出的汇总(flush/析构时); 返回summary.pending
+      bool drain(DupSummary& summary){
+        std::unique_lock<std::mutex> lock(_mutex);
+        emitSummary(summary);
+        return summary.pending;
+      }
+
+      uint64_t suppressed() const { return _suppressed.get(); }
+
+    private:
+      //在锁内生成汇总,不输出
+      void emitSummary(DupSummary& summary){
+        summary.pending = _count!=0;
+        if(!summary.pending) return;
+        summary.level = _level;
+        summary.file = _file;
+        summary.line = _line;
+        summary.text = "last message repeated "+std::to_string(_count)+" times";
+        _count = 0;
+      }
+
+      //哈希相同时的精确比较
+      bool same(LogLevel::Value level,const char* file,size_t line,const char* data,size_t len) const {
+        return level==_level && line==_line && _body.size()==len && _file==file && memcmp(_body.data(),data,len)==0;
+      }
+
+      //一次处理8字节: 大消息体(payload)也只需很少的周期
+      static uint64_t mix(uint64_t h,const void* p,size_t n){
+        const uint64_t prime = 1099511628211ull;
+        const char* s = static_cast<const char*>(p);
+        uint64_t w;
+        for(;n>=8;n-=8,s+=8){
+          memcpy(&w,s,8);
+          h = (h^w)*prime;
+          h ^= h>>29;
+        }
+        w = 0;
+        memcpy(&w,s,n);
+        h = (h^w^(uint64_t)n<<56)*prime;
+        return h^(h>>29);
+      }
+      static uint64_t hash(LogLevel::Value level,const char* file,size_t line,const char* data,size_t len){
+        uint64_t h = 14695981039346656037ull;
+        h = mix(h,&level,sizeof(level));
+        h = mix(h,&line,sizeof(line));
+        h = mix(h,file,strlen(file));
+        return mix(h,data,len);
+      }
+
+    private:
+      const uint64_t _window_ns;
+      std::mutex _mutex;
+      bool _valid;             //已有上一条记录
+      uint64_t _hash;          //上一条记录的哈希
+      LogLevel::Value _level;  //上一条记录的调用点,用于汇总
+      std::string _file;
+      size_t _line;
+      std::string _body;       //上一条记录的消息体,哈希相同时逐字节比较
+      uint64_t _count;         //上一条记录之后被折叠的条数
+      uint64_t _since;         //窗口起点(steady ns)
+      Counter _suppressed;     //累计折叠条数
+  };
+
+} //namespace_log_END
+
+#endif
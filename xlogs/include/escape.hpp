@@ -0,0 +1,131 @@
+#ifndef ESCAPE_HPP
+#define ESCAPE_HPP
+
+#include<string>
+#include<cstring>
+#include<cstdint>
+
+#if defined(__SSE2__)
+#include<emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#endif
+
+/*
+  消息体控制字符转义 -- 格式 %m{escape}
+  消息中的换行会让按行采集的系统把一条日志拆成多条,用户输入中的换行/ANSI转义还可以伪造日志行或篡改终端显示
+  转义规则: \n -> "\n"  \r -> "\r"  其他控制字符(0x00-0x1f,0x7f,除\t外) -> "\xHH"
+            \t与反斜杠保持原样(不追求可逆,只保证一条日志一行)
+
+  热路径是"没有需要转义的字符": 向量化查找第一个控制字符,找不到时整段append,速度接近memcpy
+    AVX2: 一次32字节(运行时检测CPU,函数级target属性,不需要额外编译选项)
+    SSE2: 一次16字节
+    其余平台逐字节
+*/
+
+namespace log{
+  namespace escape{
+
+    inline bool isControl(unsigned char c){
+      return (c<0x20 && c!='\t') || c==0x7f;
+    }
+
+    //返回第一个需要转义的字节的下标,没有时返回n
+    inline size_t findControlScalar(const char* p,size_t n){
+      for(size_t i = 0;i<n;i++){
+        if(isControl(p[i])) return i;
+      }
+      return n;
+    }
+
+#if defined(__SSE2__)
+    //c<=0x1f 用无符号min比较: min(c,0x1f)==c; 再去掉\t,加上0x7f
+    inline size_t findControlSse2(const char* p,size_t n){
+      const __m128i limit = _mm_set1_epi8(0x1f);
+      const __m128i tab = _mm_set1_epi8('\t');
+      const __m128i del = _mm_set1_epi8(0x7f);
+      size_t i = 0;
+      for(;i+16<=n;i+=16){
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p+i));
+        __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v,limit),v);
+        ctl = _mm_andnot_si128(_mm_cmpeq_epi8(v,tab),ctl);
+        ctl = _mm_or_si128(ctl,_mm_cmpeq_epi8(v,del));
+        unsigned mask = _mm_movemask_epi8(ctl);
+        if(mask) return i+__builtin_ctz(mask);
+      }
+      return i+findControlScalar(p+i,n-i);
+    }
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XLOG_ESCAPE_AVX2 1
+    //32字节中控制字符所在字节置0xff
+    __attribute__((target("avx2")))
+    inline __m256i controlAvx2(const char* p){
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v,_mm256_set1_epi8(0x1f)),v);
+      ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v,_mm256_set1_epi8('\t')),ctl);
+      return _mm256_or_si256(ctl,_mm256_cmpeq_epi8(v,_mm256_set1_epi8(0x7f)));
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t findControlAvx2(const char* p,size_t n){
+      size_t i = 0;
+      //一次64字节: 两块结果合并后只做一次判断
+      for(;i+64<=n;i+=64){
+        __m256i c0 = controlAvx2(p+i);
+        __m256i c1 = controlAvx2(p+i+32);
+        if(_mm256_testz_si256(_mm256_or_si256(c0,c1),_mm256_or_si256(c0,c1))) continue;
+        unsigned m0 = _mm256_movemask_epi8(c0);
+        if(m0) return i+__builtin_ctz(m0);
+        return i+32+__builtin_ctz((unsigned)_mm256_movemask_epi8(c1));
+      }
+      for(;i+32<=n;i+=32){
+        unsigned mask = _mm256_movemask_epi8(controlAvx2(p+i));
+        if(mask) return i+__builtin_ctz(mask);
+      }
+      return i+findControlScalar(p+i,n-i);
+    }
+#endif
+
+    using FindFn = size_t(*)(const char*,size_t);
+
+    //按CPU选择实现,只检测一次
+    inline FindFn selectFind(){
+#if defined(XLOG_ESCAPE_AVX2)
+      if(__builtin_cpu_supports("avx2")) return findControlAvx2;
+#endif
+#if defined(__SSE2__)
+      return findControlSse2;
+#else
+      return findControlScalar;
+#endif
+    }
+
+    inline size_t findControl(const char* p,size_t n){
+      static const FindFn fn = selectFind();
+      return fn(p,n);
+    }
+
+    //转义后追加到out; find可指定查找实现(基准对比用)
+    inline void append(std::string& out,const char* p,size_t n,FindFn find = nullptr){
+      static const char hex[] = "0123456789abcdef";
+      while(n>0){
+        size_t run = find? find(p,n):findControl(p,n);
+        out.append(p,run);
+        if(run==n) return;
+        unsigned char c = p[run];
+        char esc[4] = {'\\','x',hex[c>>4],hex[c&0xf]};
+        if(c=='\n') out.append("\\n",2);
+        else if(c=='\r') out.append("\\r",2);
+        else out.append(esc,4);
+        p += run+1;
+        n -= run+1;
+      }
+    }
+
+  } //namespace_escape_END
+} //namespace_log_END
+
+#endif
@@ -9,6 +9,12 @@
 #include<vector>
 #include<memory>
 #include<cassert>
+#include<atomic>
+#include<cstdint>
+#include<cstring>
+#include<functional>
+#include<map>
+#include<mutex>
 
 #include<unistd.h>
 
@@ -16,19 +22,21 @@
 #include"util.hpp"
 #include"message.hpp"
 #include"level.hpp"
+#include"escape.hpp"
 
 /*
   日志格式化模块
   : 对日志消息进行格式化,组织成指定格式的字符串
 
 pattern成员：保存⽇志输出的格式字符串。 
- %d ⽇期 
- %t 线程id 
- %p ⽇志优先级/级别     -- DEBUG,ERROR...
+ %d ⽇期             -- %d{...}内为strftime格式,另支持亚秒 %3N(毫秒) %6N(微秒) %9N/%N(纳秒)
+ %t 线程id           -- 内核线程id,每线程缓存一次
+ %N 线程名           -- util::ThreadUtil::setThreadName设置,默认为系统线程名
+ %p ⽇志优先级/级别     -- DEBUG,ERROR...  %p{color}为带ANSI颜色的等级(终端输出)
  %c ⽇志器名称category  -- [root]
  %f ⽂件名 
  %l ⾏号 
- %m ⽇志消息 
+ %m ⽇志消息         -- %m{escape}转义消息中的控制字符(换行,ANSI转义等),保证一条日志一行,见escape.hpp
  %T 缩进 
  %n 换⾏ 
 
@@ -50,116 +58,153 @@ Exam:
 */
 
 
-//核心技术:类型擦除
+//核心技术:编译成指令序列
 /*
-定义数组,类型为基类(格式),用于存储派生类(不同的格式)
-解析格式规则,根据不同格式规则构造各个派生类型,存入基类数组中,实现统一的格式化方式
+解析格式规则,编译成紧凑的指令数组(操作码 + 参数),原始字符集中存放在一个字符串里,指令只记偏移与长度
+格式化时一个switch循环顺序执行指令,直接追加到字符缓冲区: 没有逐项的堆对象与虚函数调用
+相邻的原始字符(包括%n %T)合并为一条指令
+用户自定义子项: Formatter::registerItem注册格式字符与FormatItem工厂,编译为扩展指令,执行时调用其format
 */
 
 
 
 
 namespace log{
+  //用户自定义子项的接口: 把内容追加到out末尾
   class FormatItem{
     public:
-      virtual void format(std::ostream& out,const LogMsg& msg) = 0;
+      using s_ptr = std::shared_ptr<FormatItem>;
+      virtual ~FormatItem(){}
+      virtual void format(std::string& out,const LogMsg& msg) = 0;
   };
 
+  /*
+    时间子项 %d{...}
+    除strftime的格式外,支持亚秒(与GNU date一致):
+      %3N 毫秒(3位)  %6N 微秒(6位)  %9N / %N 纳秒(9位)
+    例: %d{%H:%M:%S.%3N} -> 12:30:45.123
+
+    秒级部分每线程每秒只做一次localtime_r+strftime,结果缓存;同一秒内只拷贝缓存并填写亚秒数字
+  */
   class TimeFormatItem :public FormatItem{
     public:
-      TimeFormatItem(const std::string& format):_time_fmt(format){ }
-      void format(std::ostream &out,const LogMsg& msg) override{
-        struct tm t;
-        localtime_r(&msg._time,&t);
-        char tmp[32] = {0};
-        strftime(tmp,31,_time_fmt.c_str(),&t);
-        out<<tmp;
+      TimeFormatItem(const std::string& format):_time_fmt(format),_id(nextId()){
+        parse();
+      }
+      void format(std::string &out,const LogMsg& msg) override{
+        const Cache& cache = rendered(msg._time);
+        uint32_t frac_ns = msg._time_ns%1000000000ull;
+        for(size_t i = 0;i<_pieces.size();i++){
+          if(_pieces[i].digits==0){
+            out.append(cache.parts[i]);
+          }
+          else{
+            char buf[9];
+            writeFraction(buf,frac_ns,_pieces[i].digits);
+            out.append(buf,_pieces[i].digits);
+          }
+        }
       }
     private:
-      std::string _time_fmt;
-  };
-
-  class TidFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-          out<<msg._tid;    
+      struct Piece{
+        std::string fmt; //strftime格式
+        int digits;      //>0表示亚秒子项的位数
+      };
+      struct Cache{
+        uint64_t owner = 0;   //所属子项的id -- 不用this,避免对象释放后地址复用命中旧缓存
+        time_t sec = -1;
+        std::vector<std::string> parts;
+      };
+
+      //拆分为 strftime片段 与 亚秒子项
+      void parse(){
+        std::string cur;
+        size_t i = 0;
+        while(i<_time_fmt.size()){
+          if(_time_fmt[i]=='%' && i+1<_time_fmt.size()){
+            char c = _time_fmt[i+1];
+            int digits = 0;
+            size_t skip = 0;
+            if(c=='N'){ digits = 9; skip = 2; }
+            else if((c=='3'||c=='6'||c=='9') && i+2<_time_fmt.size() && _time_fmt[i+2]=='N'){
+              digits = c-'0';
+              skip = 3;
+            }
+            if(digits){
+              if(!cur.empty()){ _pieces.push_back(Piece{cur,0}); cur.clear(); }
+              _pieces.push_back(Piece{"",digits});
+              i += skip;
+              continue;
+            }
+            cur += _time_fmt[i];
+            cur += c; //%%等两字符序列原样交给strftime
+            i += 2;
+            continue;
+          }
+          cur += _time_fmt[i++];
+        }
+        if(!cur.empty()) _pieces.push_back(Piece{cur,0});
       }
-  };
 
-
-  //priority level = PRI
-  class LevelFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-       	out<<LogLevel::toString(msg._level);
+      //当前线程的秒级渲染缓存; 每线程4个槽,多个日志器/格式交替使用时互不驱逐
+      const Cache& rendered(time_t sec){
+        thread_local Cache slots[4];
+        thread_local size_t victim = 0;
+        for(auto& c:slots){
+          if(c.owner==_id){
+            if(c.sec!=sec) fill(c,sec);
+            return c;
+          }
+        }
+        Cache& c = slots[victim++%4];
+        c.owner = _id;
+        fill(c,sec);
+        return c;
       }
-  };
 
-  //LoggerName
-  class LoggerFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-        out<<msg._loggername;  
+      void fill(Cache& c,time_t sec){
+        struct tm t;
+        localtime_r(&sec,&t);
+        c.sec = sec;
+        c.parts.resize(_pieces.size());
+        for(size_t i = 0;i<_pieces.size();i++){
+          if(_pieces[i].digits) continue;
+          char tmp[64] = {0};
+          size_t n = strftime(tmp,sizeof(tmp)-1,_pieces[i].fmt.c_str(),&t);
+          c.parts[i].assign(tmp,n);
+        }
       }
-  };
 
-  //FileName
-  class FileFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-        out<<msg._filename;
-      }
-  };
-  class LineFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-        out<<msg._line; 
-      }
-  };
-  class MsgFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-        out<<msg._payload; 
+      //纳秒部分取高digits位,定长补零
+      static void writeFraction(char* buf,uint32_t frac_ns,int digits){
+        for(int i = digits;i<9;i++) frac_ns /= 10;
+        for(int i = digits-1;i>=0;i--){
+          buf[i] = '0'+frac_ns%10;
+          frac_ns /= 10;
+        }
       }
-  };
 
-  //NewLine
-  class NLineFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-        (void)msg;
-        out<<"\n";
-      }
-  };
-  class TabFormatItem:public FormatItem{
-    public:
-      void format(std::ostream &out,const LogMsg& msg){
-        (void)msg;
-        out<<"\t"; 
+      static uint64_t nextId(){
+        static std::atomic<uint64_t> id(0);
+        return ++id;
       }
-  };
 
-  class OtherFormatItem:public FormatItem{
-    public:
-      OtherFormatItem(const std::string& str):_str(str){ }
-      void format(std::ostream &out,const LogMsg&msg){
-        (void)msg;
-        out<<_str;
-      }
     private:
-      std::string _str;
+      std::string _time_fmt;
+      uint64_t _id;
+      std::vector<Piece> _pieces;
   };
 
-
   //格式化器 
   class Formatter{
 
     /*
-      _pattern -> parsePattern() -> createItem() -> _items -> format() -> OUT:Msg
+      _pattern -> parsePattern() -> compile() -> _program -> format() -> OUT:Msg
      */
     
     public:
       using s_ptr = std::shared_ptr<log::Formatter>;
+      using ItemFactory = std::function<FormatItem::s_ptr(const std::string& value)>;
       Formatter(const std::string& pattern = "[%d{%H:%M:%S}][%t][%p][%c][%f:%l] %m%n")
         :_pattern(pattern)
         {
@@ -168,35 +213,191 @@ namespace log{
       
       const std::string pattern() { return _pattern; }
 
+      //把规则中不带子项的%p换成%p{color}; %%与其他子项{}(如%d{%I %p})中的内容不变
+      static std::string colorPattern(const std::string& pattern){
+        std::string out;
+        size_t pos = 0;
+        while(pos<pattern.size()){
+          if(pattern[pos]!='%' || pos+1==pattern.size()){
+            out += pattern[pos++];
+            continue;
+          }
+          char key = pattern[pos+1];
+          out += '%';
+          out += key;
+          pos += 2;
+          if(key=='%') continue;
+          if(pos<pattern.size() && pattern[pos]=='{'){
+            size_t end = pattern.find('}',pos);
+            end = end==std::string::npos? pattern.size():end+1;
+            out.append(pattern,pos,end-pos);
+            pos = end;
+          }
+          else if(key=='p'){
+            out += "{color}";
+          }
+        }
+        return out;
+      }
+
+      //注册用户自定义子项 %key{value}: 须在构造使用它的格式化器之前注册; 不能覆盖内置格式字符
+      static bool registerItem(char key,const ItemFactory& factory){
+        if(key=='\0' || strchr("mpdcflnTtN%",key)!=nullptr) return false;
+        std::unique_lock<std::mutex> lock(registryMutex());
+        registry()[key] = factory;
+        return true;
+      }
+
       std::string format(const LogMsg& msg){
-        std::stringstream ss;
-        format(ss,msg); //父类引用/指针接收子类对象
-        return ss.str();
+        std::string out;
+        out.reserve(_literals.size()+msg._payload.size()+64);
+        format(out,msg);
+        return out;
       }
-      
+
       std::ostream& format(std::ostream &os, const LogMsg &msg) {
-        for (auto &it : _items) {
-          it->format(os, msg);
-        }
-        return os;
+        static thread_local std::string out;
+        out.clear();
+        format(out,msg);
+        return os.write(out.data(),out.size());
+      }
+
+      //追加到out末尾
+      void format(std::string& out,const LogMsg& msg){
+        run(out,msg,0,_program.size());
       }
 
+      //零拷贝消息体(Logger::payload): 规则中恰好有一个%m且没有%m{escape}时,分别格式化%m之前与之后的部分,消息体由调用方直接交给落地
+      bool splittable() const { return _msg_count==1 && !_msg_escape; }
+      void formatHead(std::string& out,const LogMsg& msg){ run(out,msg,0,_msg_at); }
+      void formatTail(std::string& out,const LogMsg& msg){ run(out,msg,_msg_at+1,_program.size()); }
+
     private:
+      //执行[begin,end)的指令
+      void run(std::string& out,const LogMsg& msg,size_t begin,size_t end){
+        for(size_t i = begin;i<end;i++){
+          const Instr& in = _program[i];
+          switch(in.op){
+            case OP_LITERAL: out.append(_literals.data()+in.arg,in.len); break;
+            case OP_TIME: _times[in.arg].format(out,msg); break;
+            case OP_TID: out.append(msg._thread->tid,msg._thread->tid_len); break;
+            case OP_THREAD_NAME: out.append(msg._thread->name); break;
+            case OP_LEVEL: out.append(LogLevel::toString(msg._level)); break;
+            case OP_LEVEL_COLOR:
+              out.append(colorCode(msg._level));
+              out.append(LogLevel::toString(msg._level));
+              out.append("\033[0m",4);
+              break;
+            case OP_LOGGER: out.append(msg._loggername); break;
+            case OP_FILE: out.append(msg._filename); break;
+            case OP_LINE: appendUint(out,msg._line); break;
+            case OP_MSG: out.append(msg._payload); break;
+            case OP_MSG_ESCAPE: escape::append(out,msg._payload.data(),msg._payload.size()); break;
+            case OP_EXTENSION: _exts[in.arg]->format(out,msg); break;
+          }
+        }
+      }
+
+      enum OpCode : uint8_t{
+        OP_LITERAL,      //arg: _literals中的偏移, len: 长度
+        OP_TIME,         //arg: _times下标
+        OP_TID,
+        OP_THREAD_NAME,
+        OP_LEVEL,
+        OP_LEVEL_COLOR,
+        OP_LOGGER,
+        OP_FILE,
+        OP_LINE,
+        OP_MSG,
+        OP_MSG_ESCAPE,
+        OP_EXTENSION     //arg: _exts下标
+      };
+      struct Instr{
+        uint8_t op;
+        uint32_t arg;
+        uint32_t len;
+      };
+
+      static std::map<char,ItemFactory>& registry(){
+        static std::map<char,ItemFactory> items;
+        return items;
+      }
+      static std::mutex& registryMutex(){
+        static std::mutex mutex;
+        return mutex;
+      }
+
+      static const char* colorCode(LogLevel::Value level){
+        switch(level){
+          case LogLevel::Value::DEBUG: return "\033[36m";   //青
+          case LogLevel::Value::INFO: return "\033[32m";    //绿
+          case LogLevel::Value::WARN: return "\033[33m";    //黄
+          case LogLevel::Value::ERROR: return "\033[31m";   //红
+          case LogLevel::Value::FATAL: return "\033[1;31m"; //粗体红
+          default: return "\033[0m";
+        }
+      }
 
-      std::shared_ptr<FormatItem> createItem(const std::string& key,const std::string& value){
-        if(key=="m") return std::make_shared<MsgFormatItem>();
-        if(key=="p") return std::make_shared<LevelFormatItem>();
-        if(key=="d") return std::make_shared<TimeFormatItem>(value);
-        if(key=="c") return std::make_shared<LoggerFormatItem>();
-        if(key=="f") return std::make_shared<FileFormatItem>();
-        if(key=="l") return std::make_shared<LineFormatItem>();
-        if(key=="n") return std::make_shared<NLineFormatItem>();
-        if(key=="T") return std::make_shared<TabFormatItem>();
-        if(key=="t") return std::make_shared<TidFormatItem>();
-        if(key=="") return std::make_shared<OtherFormatItem>(value);
-        std::cout<<"规则错误,不是已定义的格式化规则: %"<<key<<"\n";
-        abort();
-        return nullptr;
+      static void appendUint(std::string& out,size_t v){
+        char buf[20];
+        char* p = buf+sizeof(buf);
+        do{ *--p = '0'+v%10; v /= 10; }while(v);
+        out.append(p,buf+sizeof(buf)-p);
+      }
+
+      void emitLiteral(const std::string& str){
+        if(str.empty()) return;
+        //与上一条原始字符指令相邻时合并
+        if(!_program.empty() && _program.back().op==OP_LITERAL && _program.back().arg+_program.back().len==_literals.size()){
+          _program.back().len += str.size();
+        }
+        else{
+          _program.push_back(Instr{OP_LITERAL,(uint32_t)_literals.size(),(uint32_t)str.size()});
+        }
+        _literals += str;
+      }
+
+      void emit(OpCode op,uint32_t arg = 0){
+        if(op==OP_MSG){
+          _msg_at = _program.size();
+          _msg_count++;
+        }
+        if(op==OP_MSG_ESCAPE) _msg_escape = true;
+        _program.push_back(Instr{op,arg,0});
+      }
+
+      //一项解析结果编译成指令
+      bool compile(const std::string& key,const std::string& value){
+        if(key=="") emitLiteral(value);
+        else if(key=="n") emitLiteral("\n");
+        else if(key=="T") emitLiteral("\t");
+        else if(key=="m") emit(value=="escape"? OP_MSG_ESCAPE:OP_MSG);
+        else if(key=="p") emit(value=="color"? OP_LEVEL_COLOR:OP_LEVEL);
+        else if(key=="d"){
+          _times.push_back(TimeFormatItem(value));
+          emit(OP_TIME,_times.size()-1);
+        }
+        else if(key=="c") emit(OP_LOGGER);
+        else if(key=="f") emit(OP_FILE);
+        else if(key=="l") emit(OP_LINE);
+        else if(key=="t") emit(OP_TID);
+        else if(key=="N") emit(OP_THREAD_NAME);
+        else{
+          ItemFactory factory;
+          {
+            std::unique_lock<std::mutex> lock(registryMutex());
+            auto it = registry().find(key[0]);
+            if(it!=registry().end()) factory = it->second;
+          }
+          if(!factory){
+            std::cout<<"规则错误,不是已定义的格式化规则: %"<<key<<"\n";
+            abort();
+            return false;
+          }
+          _exts.push_back(factory(value));
+          emit(OP_EXTENSION,_exts.size()-1);
+        }
+        return true;
       }
 
       //解析格式化规则
@@ -287,11 +488,15 @@ namespace log{
           key.clear();
           value.clear();
         }
+        //结尾的原始字符
+        if(!value.empty()){
+          order.push_back(std::make_pair("",value));
+        }
 
-        //将存储的结果输出--映射关系
+        //编译成指令序列
         for(auto& it:order){
           //std::cout<<it.first<<" "<<it.second<<"\n";
-          _items.push_back(createItem(it.first,it.second));
+          if(!compile(it.first,it.second)) return false;
         }
 
         return true;
@@ -299,8 +504,14 @@ namespace log{
 
 
     private:
-      std::string _pattern;                            //格式化规则
-      std::vector<std::shared_ptr<FormatItem>> _items; //解析好的格式化规则元素序列
+      std::string _pattern;                 //格式化规则
+      std::vector<Instr> _program;          //编译好的指令序列
+      std::string _literals;                //所有原始字符
+      std::vector<TimeFormatItem> _times;   //时间子项(带每线程秒级缓存)
+      std::vector<FormatItem::s_ptr> _exts; //用户自定义子项
+      size_t _msg_at = 0;                   //%m指令的位置
+      size_t _msg_count = 0;                //%m出现的次数
+      bool _msg_escape = false;             //有%m{escape}: 消息体需要转义,不能零拷贝
   };
 
 } //namespace_log_END
@@ -11,11 +11,20 @@
 #include <mutex>
 #include <cstdio>
 #include <cstdarg>
+#include <future>
 #include "format.hpp"
 #include "sink.hpp"
 #include "level.hpp"
 #include "looper.hpp"
+#include "metrics.hpp"
+#include "backtrace.hpp"
+#include "dedup.hpp"
+#include "alloc_trace.hpp"
 #include<unordered_map>
+#include<queue>
+#include<algorithm>
+#include<cstring>
+#include<type_traits>
 
 namespace log
 {
@@ -49,7 +58,9 @@ namespace log
            Formatter::s_ptr& formatter,
            std::vector<LogSink::s_ptr> &sinks)
         : _logger_name(logger_name), _limit_level(level), _formatter_sp(formatter), _sinks(sinks.begin(), sinks.end())
-    {}
+    {
+      groupSinks();
+    }
 
     const std::string& name(){
       return _logger_name;
@@ -57,15 +68,24 @@ namespace log
 
     // 构造对应等级的日志消息对象并格式化成日志消息字符串,然后进行落地输出
     //  是否满足等级 -> 解析不定参 -> serialize(封装,可略){ LogMsg msg -> formatter(pattern).format(msg)-> data -> sink }
-    void debug(const std::string &file, size_t line, const char *fmt, ...)
+    void debug(const char *file, size_t line, const char *fmt, ...)
     {
       // 判断等级
       if (_limit_level > LogLevel::Value::DEBUG)
       {
+        //回溯环: 不格式化,只记录原始参数
+        if (_backtrace)
+        {
+          va_list arg;
+          va_start(arg, fmt);
+          _backtrace->push(LogLevel::Value::DEBUG, file, line, fmt, arg);
+          va_end(arg);
+        }
         return;
       }
 
       // 解析不定参
+      XLOG_ALLOC_SCOPE(VASPRINTF);
       va_list arg; // al,arg,ap,arg_ptr,char*
       va_start(arg, fmt);
       char *buf;
@@ -75,15 +95,24 @@ namespace log
       free(buf);
     }
     
-    void info(const std::string &file, size_t line, const char *fmt, ...)
+    void info(const char *file, size_t line, const char *fmt, ...)
     {
       // 判断等级
       if (_limit_level > LogLevel::Value::INFO)
       {
+        //回溯环: 不格式化,只记录原始参数
+        if (_backtrace)
+        {
+          va_list arg;
+          va_start(arg, fmt);
+          _backtrace->push(LogLevel::Value::INFO, file, line, fmt, arg);
+          va_end(arg);
+        }
         return;
       }
 
       // 解析不定参
+      XLOG_ALLOC_SCOPE(VASPRINTF);
       va_list arg; // al,arg,ap,arg_ptr,char*
       va_start(arg, fmt);
       char *buf;
@@ -97,14 +126,23 @@ namespace log
       free(buf);
     }
     
-    void warn(const std::string &file, size_t line, const char *fmt, ...)
+    void warn(const char *file, size_t line, const char *fmt, ...)
     {
       // 判断等级
       if (_limit_level > LogLevel::Value::WARN)
       {
+        //回溯环: 不格式化,只记录原始参数
+        if (_backtrace)
+        {
+          va_list arg;
+          va_start(arg, fmt);
+          _backtrace->push(LogLevel::Value::WARN, file, line, fmt, arg);
+          va_end(arg);
+        }
         return;
       }
       // 解析不定参
+      XLOG_ALLOC_SCOPE(VASPRINTF);
       va_list arg; // al,arg,ap,arg_ptr,char*
       va_start(arg, fmt);
       char *buf;
@@ -114,60 +152,420 @@ namespace log
       free(buf);
     }
     
-    void error(const std::string &file, size_t line, const char *fmt, ...)
+    void error(const char *file, size_t line, const char *fmt, ...)
     {
       // 判断等级
       if (_limit_level > LogLevel::Value::ERROR)
       {
+        //回溯环: 不格式化,只记录原始参数
+        if (_backtrace)
+        {
+          va_list arg;
+          va_start(arg, fmt);
+          _backtrace->push(LogLevel::Value::ERROR, file, line, fmt, arg);
+          va_end(arg);
+        }
         return;
       }
 
       // 解析不定参
+      XLOG_ALLOC_SCOPE(VASPRINTF);
       va_list arg; // al,arg,ap,arg_ptr,char*
       va_start(arg, fmt);
       char *buf;
       vasprintf(&buf, fmt, arg); // 解析不定参,转换成字符串 --GNU,自动计算并malloc
       va_end(arg);
+      //先输出出错前的上下文
+      if (_backtrace)
+      {
+        dumpBacktrace(LogLevel::Value::ERROR);
+      }
       serialize(LogLevel::Value::ERROR, file, line, buf);
       free(buf);
     }
-    void fatal(const std::string &file, size_t line, const char *fmt, ...)
+    void fatal(const char *file, size_t line, const char *fmt, ...)
     {
       // 判断等级
       if (_limit_level > LogLevel::Value::FATAL)
       {
+        //回溯环: 不格式化,只记录原始参数
+        if (_backtrace)
+        {
+          va_list arg;
+          va_start(arg, fmt);
+          _backtrace->push(LogLevel::Value::FATAL, file, line, fmt, arg);
+          va_end(arg);
+        }
         return;
       }
 
       // 解析不定参
+      XLOG_ALLOC_SCOPE(VASPRINTF);
       va_list arg; // al,arg,ap,arg_ptr,char*
       va_start(arg, fmt);
       char *buf;
       vasprintf(&buf, fmt, arg); // 解析不定参,转换成字符串 --GNU,自动计算并malloc
       va_end(arg);
+      //先输出出错前的上下文
+      if (_backtrace)
+      {
+        dumpBacktrace(LogLevel::Value::FATAL);
+      }
       serialize(LogLevel::Value::FATAL, file, line, buf);
       free(buf);
     }
 
+    //文件名为std::string的调用方(旧接口): 转发到const char*版本
+    //文件名只在本次调用期间使用,临时std::string也安全
+    //只对std::string启用: const char*实参的可变参数版本(...)排序最低,不限制会选回模板自身无限递归
+    template <class Str, class... Args>
+    typename std::enable_if<std::is_same<Str, std::string>::value>::type
+    debug(const Str &file, size_t line, const char *fmt, Args &&...args)
+    {
+      debug(file.c_str(), line, fmt, std::forward<Args>(args)...);
+    }
+    template <class Str, class... Args>
+    typename std::enable_if<std::is_same<Str, std::string>::value>::type
+    info(const Str &file, size_t line, const char *fmt, Args &&...args)
+    {
+      info(file.c_str(), line, fmt, std::forward<Args>(args)...);
+    }
+    template <class Str, class... Args>
+    typename std::enable_if<std::is_same<Str, std::string>::value>::type
+    warn(const Str &file, size_t line, const char *fmt, Args &&...args)
+    {
+      warn(file.c_str(), line, fmt, std::forward<Args>(args)...);
+    }
+    template <class Str, class... Args>
+    typename std::enable_if<std::is_same<Str, std::string>::value>::type
+    error(const Str &file, size_t line, const char *fmt, Args &&...args)
+    {
+      error(file.c_str(), line, fmt, std::forward<Args>(args)...);
+    }
+    template <class Str, class... Args>
+    typename std::enable_if<std::is_same<Str, std::string>::value>::type
+    fatal(const Str &file, size_t line, const char *fmt, Args &&...args)
+    {
+      fatal(file.c_str(), line, fmt, std::forward<Args>(args)...);
+    }
+
+    /*
+      零拷贝消息体 -- 大块数据(请求转储等)不经过vasprintf,LogMsg与格式化器的拷贝
+      data/len为调用方的缓冲区,原样作为%m输出(不做printf解析)
+      只有一组格式且规则中恰好有一个%m时: 只格式化%m前后的部分,三段以iovec交给日志器
+        同步日志器: 落地用writev/分段写直接写出调用方的数据,不拷贝
+        异步日志器: 持一次锁拷入缓冲区,只拷贝这一次
+      其他情况退化为普通路径
+      release: 返回前调用(数据已写出或已拷入缓冲区),调用方可以在其中释放缓冲区; 等级不足时也会调用
+    */
+    void payload(const char *file, size_t line, LogLevel::Value level, const char *data, size_t len,
+                 const std::function<void(const char *, size_t)> &release = nullptr)
+    {
+      if (level >= _limit_level)
+      {
+        if (_backtrace && level >= LogLevel::Value::ERROR)
+        {
+          dumpBacktrace(level);
+        }
+        emitPayload(level, file, line, data, len);
+      }
+      if (release)
+      {
+        release(data, len);
+      }
+    }
+    void payload(const std::string &file, size_t line, LogLevel::Value level, const char *data, size_t len,
+                 const std::function<void(const char *, size_t)> &release = nullptr)
+    {
+      payload(file.c_str(), line, level, data, len, release);
+    }
+
   protected:
-    void serialize(LogLevel::Value level, const std::string &file, size_t line, const std::string &buf)
+    /*
+      按格式化器分组落地
+      每个落地可以有自己的格式化器(LoggerBuilder::buildFormattedSink),没有的使用日志器的格式化器
+      pattern相同的落地归为一组,每条消息每组只格式化一次,而不是每个落地一次
+
+      只有一组时(默认): 格式化结果直接交给log,与原来一致
+      多组时: 各组结果拼成一条带帧头的记录 [FrameHeader][数据][FrameHeader][数据]... 一次交给log
+              同步日志器逐帧写到对应组的落地; 异步日志器整条入队,后台按组拆到各自的缓冲区后批量落地
+    */
+    struct FrameHeader
+    {
+      uint32_t group;
+      uint32_t len;
+    };
+    struct SinkGroup
+    {
+      std::string pattern;
+      Formatter::s_ptr formatter;
+      std::vector<LogSink::s_ptr> sinks;
+    };
+
+    void groupSinks()
+    {
+      for (auto &sink : _sinks)
+      {
+        Formatter::s_ptr fmt = sink->formatter() ? sink->formatter() : _formatter_sp;
+        std::string pattern = fmt->pattern();
+        //输出到终端的落地: 日志器格式中的等级换成带颜色的,与其他落地按不同格式分组
+        if (!sink->formatter() && sink->colorLevel())
+        {
+          pattern = Formatter::colorPattern(pattern);
+          fmt.reset();
+        }
+        auto it = std::find_if(_groups.begin(), _groups.end(), [&](const SinkGroup &g){ return g.pattern == pattern; });
+        if (it == _groups.end())
+        {
+          _groups.push_back(SinkGroup{pattern, fmt ? fmt : std::make_shared<Formatter>(pattern), {}});
+          it = _groups.end() - 1;
+        }
+        it->sinks.push_back(sink);
+      }
+      if (_groups.empty())
+      {
+        _groups.push_back(SinkGroup{_formatter_sp->pattern(), _formatter_sp, {}});
+      }
+    }
+
+    //多组时逐帧回调 fn(组号,数据,长度)
+    template <class Fn>
+    static void forEachFrame(const char *data, size_t len, Fn fn)
+    {
+      while (len >= sizeof(FrameHeader))
+      {
+        FrameHeader hdr;
+        memcpy(&hdr, data, sizeof(hdr));
+        data += sizeof(hdr);
+        fn(hdr.group, data, hdr.len);
+        data += hdr.len;
+        len -= sizeof(hdr) + hdr.len;
+      }
+    }
+
+    //单条或整批交给落地; 多组时按帧拆到各组的缓冲区(group_bufs),每组一次落地
+    //调用方保证串行(同步日志器持_mutex,异步日志器在后台线程)
+    void writeGroups(const char *data, size_t len, std::vector<Buffer> &group_bufs)
+    {
+      if (_groups.size() == 1)
+      {
+        for (auto &sink : _groups[0].sinks)
+        {
+          sink->write(data, len);
+        }
+        return;
+      }
+      forEachFrame(data, len, [&](uint32_t group, const char *frame, size_t n){
+        group_bufs[group].push(frame, n);
+      });
+      for (size_t g = 0; g < _groups.size(); g++)
+      {
+        if (group_bufs[g].empty()) continue;
+        for (auto &sink : _groups[g].sinks)
+        {
+          sink->write(group_bufs[g].begin(), group_bufs[g].readAbleSize());
+        }
+        group_bufs[g].reset();
+      }
+    }
+
+    void serialize(LogLevel::Value level, const char *file, size_t line, const std::string &buf)
     {
+      if (_dedup && suppressDup(level, file, line, buf.data(), buf.size()))
+      {
+        return;
+      }
       // 构造消息对象
-      LogMsg msg(level, file, line, _logger_name, buf);
+      XLOG_ALLOC_SCOPE(LOGMSG);
+      LogMsg msg(level, file, line, _logger_name.c_str(), buf);
+      emit(msg);
+    }
 
-      // 格式化
-      std::string str = _formatter_sp->format(msg);
+    //格式化并交给log
+    void emit(const LogMsg &msg)
+    {
+      emit(msg, msg._level);
+    }
+
+    //route: 交给log的等级,决定走哪条通道(回溯记录随触发它的错误走同一通道)
+    void emit(const LogMsg &msg, LogLevel::Value route)
+    {
+      //格式化到每线程复用的缓冲区,稳定后不再分配
+      static thread_local std::string frame;
+      frame.clear();
+      if (_groups.size() == 1)
+      {
+        {
+          XLOG_ALLOC_SCOPE(FORMAT);
+          _groups[0].formatter->format(frame, msg);
+        }
+        XLOG_ALLOC_SCOPE(SINK);
+        log(frame.data(), frame.size(), route);
+        return;
+      }
+      //每组格式化一次,拼成一条记录: 先占位帧头,格式化后回填长度
+      for (size_t g = 0; g < _groups.size(); g++)
+      {
+        XLOG_ALLOC_SCOPE(FORMAT);
+        size_t off = frame.size();
+        frame.append(sizeof(FrameHeader), '\0');
+        _groups[g].formatter->format(frame, msg);
+        FrameHeader hdr{(uint32_t)g, (uint32_t)(frame.size() - off - sizeof(FrameHeader))};
+        memcpy(&frame[off], &hdr, sizeof(hdr));
+      }
 
       // 日志:w
-      log(str.c_str(), str.size());
+      XLOG_ALLOC_SCOPE(SINK);
+      log(frame.data(), frame.size(), route);
     }
     virtual void log(const char *data, size_t len) = 0;
+    //需要按等级处理的日志器(如同步批量模式)重写此接口
+    virtual void log(const char *data, size_t len, LogLevel::Value level)
+    {
+      (void)level;
+      log(data, len);
+    }
+
+    //多段记录; 默认拼接后交给log,能直接处理多段的日志器重写
+    virtual void logv(const struct iovec *iov, int cnt, LogLevel::Value level)
+    {
+      static thread_local std::string joined;
+      joined.clear();
+      for (int i = 0; i < cnt; i++)
+      {
+        joined.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+      }
+      log(joined.data(), joined.size(), level);
+    }
+
+    void emitPayload(LogLevel::Value level, const char *file, size_t line, const char *data, size_t len)
+    {
+      if (_groups.size() != 1 || !_groups[0].formatter->splittable())
+      {
+        serialize(level, file, line, std::string(data, len));
+        return;
+      }
+      if (_dedup && suppressDup(level, file, line, data, len))
+      {
+        return;
+      }
+      //消息体为空的LogMsg只用于格式化头尾
+      XLOG_ALLOC_SCOPE(LOGMSG);
+      LogMsg msg(level, file, line, _logger_name.c_str(), std::string());
+      static thread_local std::string head, tail;
+      head.clear();
+      tail.clear();
+      {
+        XLOG_ALLOC_SCOPE(FORMAT);
+        _groups[0].formatter->formatHead(head, msg);
+        _groups[0].formatter->formatTail(tail, msg);
+      }
+      struct iovec iov[3];
+      iov[0].iov_base = &head[0];
+      iov[0].iov_len = head.size();
+      iov[1].iov_base = const_cast<char *>(data);
+      iov[1].iov_len = len;
+      iov[2].iov_base = &tail[0];
+      iov[2].iov_len = tail.size();
+      XLOG_ALLOC_SCOPE(SINK);
+      logv(iov, 3, level);
+    }
+
+    //trigger: 触发输出的错误等级; 回溯记录按它选择通道,保证先于这条错误落地(高优先级通道先于普通缓冲区写出)
+    void dumpBacktrace(LogLevel::Value trigger)
+    {
+      _backtrace->dump(_logger_name, [&](const LogMsg &msg){ emit(msg, std::max(msg._level, trigger)); });
+    }
+
+    //重复折叠: 汇总在DupFilter的锁外输出,沿用被折叠记录的调用点与等级
+    bool suppressDup(LogLevel::Value level, const char *file, size_t line, const char *data, size_t len)
+    {
+      static thread_local DupSummary summary;
+      if (dupFilter().suppress(level, file, line, data, len, summary))
+      {
+        return true;
+      }
+      if (summary.pending)
+      {
+        emitDupSummary(summary);
+      }
+      return false;
+    }
+
+    void emitDupSummary(const DupSummary &summary)
+    {
+      emit(LogMsg(summary.level, summary.file.c_str(), summary.line, _logger_name.c_str(), summary.text));
+    }
+
+    //当前线程使用的折叠过滤器; 分片日志器每个分片一个
+    virtual DupFilter &dupFilter()
+    {
+      return *_dedup;
+    }
+
+    //输出尚未输出的重复汇总; flush与析构时调用
+    virtual void drainDup()
+    {
+      if (!_dedup) return;
+      DupSummary summary;
+      if (_dedup->drain(summary))
+      {
+        emitDupSummary(summary);
+      }
+    }
+
+  public:
+    //回溯环: 保留最近n条低于等级的记录,ERROR/FATAL时先输出它们; 须在开始写日志前调用
+    void enableBacktrace(size_t n)
+    {
+      _backtrace = n ? std::make_shared<BacktraceRing>(n) : nullptr;
+    }
+
+    //重复消息折叠: 相邻的相同记录(调用点+消息体)在window_ms内只输出一次,之后补一条汇总; 0关闭; 须在开始写日志前调用
+    virtual void enableDedup(uint64_t window_ms)
+    {
+      _dedup = window_ms ? std::make_shared<DupFilter>(window_ms) : nullptr;
+    }
+
+  public:
+    //刷新: 返回的future在调用前写入的日志全部由各落地写出(fsync为true时并已落盘)后就绪
+    //同步日志器在调用线程内完成,返回时已就绪
+    virtual std::future<void> flush(bool fsync = false)
+    {
+      drainDup();
+      std::promise<void> done;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (auto &sink : _sinks)
+        {
+          sink->flush(fsync);
+        }
+      }
+      done.set_value();
+      return done.get_future();
+    }
+
+    //运行指标快照
+    virtual LoggerStats stats()
+    {
+      LoggerStats st;
+      st.name = _logger_name;
+      st.dedup_suppressed = _dedup ? _dedup->suppressed() : 0;
+      for (auto &sink : _sinks)
+      {
+        st.sinks.push_back(sink->stats());
+      }
+      return st;
+    }
 
   protected:
     std::string _logger_name;
     std::atomic<LogLevel::Value> _limit_level; // 枚举成员本质属整型类 -- 多线程输出日志,频繁访问,竞态
     Formatter::s_ptr _formatter_sp;
     std::vector<LogSink::s_ptr> _sinks;
+    std::vector<SinkGroup> _groups; // 按格式分组的落地,构造后不再变化
+    std::shared_ptr<BacktraceRing> _backtrace; // 未启用时为空
+    std::shared_ptr<DupFilter> _dedup; // 未启用时为空
     std::mutex _mutex; // 防止出现竞态条件
 
   }; // class logger  __END__
@@ -175,6 +573,20 @@ namespace log
   
  
 //与任务同步进行
+/*
+  线程局部批量模式(可选, LoggerBuilder::buildSyncBatching)
+  默认每条日志都持有_mutex逐个调用落地,多线程时所有线程串行在一把锁和一次系统调用上
+  批量模式: 每个线程先追加到自己的缓冲区,只在以下时机持锁整批交给落地
+    - 缓冲区达到batch_bytes
+    - 日志等级不低于flush_level(默认WARN),错误及时可见
+    - 线程退出
+    - flush() / 日志器析构
+  没有后台线程; 不满足以上条件时日志停留在线程缓冲区中,需要及时可见时调用flush()
+
+  线程缓冲区登记在BatchHub中,flush/析构可以取走所有线程的数据;
+  线程局部表只持有BatchHub的weak_ptr,日志器先销毁时线程退出不会访问已释放的日志器
+  锁顺序: hub.mutex -> batch.mutex -> _mutex
+*/
   class SyncLogger : public Logger
   {
   public:
@@ -182,20 +594,204 @@ namespace log
                LogLevel::Value level,
                Formatter::s_ptr& formatter,
                std::vector<LogSink::s_ptr> &sinks)
-        : Logger(logger_name, level, formatter, sinks)
+        : Logger(logger_name, level, formatter, sinks), _group_bufs(_groups.size())
     {
     }
 
+    ~SyncLogger()
+    {
+      drainDup();
+      if (_hub)
+      {
+        std::unique_lock<std::mutex> hub_lock(_hub->mutex);
+        drainAll();
+        _hub->logger = nullptr; //之后退出的线程不再访问本日志器
+      }
+    }
+
+    //开启线程局部批量; 须在开始写日志前调用
+    void enableBatching(size_t batch_bytes, LogLevel::Value flush_level)
+    {
+      _batch_bytes = batch_bytes;
+      _flush_level = flush_level;
+      _hub = std::make_shared<BatchHub>();
+      _hub->logger = this;
+    }
+
+    std::future<void> flush(bool fsync = false) override
+    {
+      drainDup();
+      if (_hub)
+      {
+        std::unique_lock<std::mutex> hub_lock(_hub->mutex);
+        drainAll();
+      }
+      return Logger::flush(fsync);
+    }
+
   protected:
     void log(const char *data, size_t len) override
     {
       std::unique_lock<std::mutex> lock(_mutex);
-      // 日志落地
-      for (auto &sink : _sinks)
+      _msgs_in.add();
+      _bytes_in.add(len);
+      dispatch(data, len);
+    }
+
+    void log(const char *data, size_t len, LogLevel::Value level) override
+    {
+      struct iovec iov{const_cast<char *>(data), len};
+      logv(&iov, 1, level);
+    }
+
+    //只有一组(emitPayload的前提): 非批量模式各段直接交给落地,批量模式拷入线程缓冲区
+    void logv(const struct iovec *iov, int cnt, LogLevel::Value level) override
+    {
+      if (!_hub)
+      {
+        if (cnt == 1)
+        {
+          log(static_cast<const char *>(iov[0].iov_base), iov[0].iov_len);
+          return;
+        }
+        size_t len = 0;
+        for (int i = 0; i < cnt; i++) len += iov[i].iov_len;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _msgs_in.add();
+        _bytes_in.add(len);
+        for (auto &sink : _groups[0].sinks)
+        {
+          sink->writev(iov, cnt);
+        }
+        return;
+      }
+      ThreadBatch &tb = localBatch();
+      std::unique_lock<std::mutex> batch_lock(tb.mutex);
+      for (int i = 0; i < cnt; i++)
+      {
+        tb.buf.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+      }
+      tb.msgs++;
+      if (tb.buf.size() >= _batch_bytes || level >= _flush_level)
+      {
+        writeBatch(tb);
+      }
+    }
+
+  private:
+    struct ThreadBatch
+    {
+      std::mutex mutex;  //本线程追加 与 flush/析构取走 之间的互斥,通常无竞争
+      std::string buf;
+      size_t msgs = 0;
+    };
+    struct BatchHub
+    {
+      std::mutex mutex;
+      std::vector<ThreadBatch *> batches; //所有线程的缓冲区
+      SyncLogger *logger = nullptr;       //日志器析构后为空
+    };
+
+    //线程局部表: 本线程在各个批量日志器中的缓冲区
+    struct BatchTable
+    {
+      struct Entry
+      {
+        std::weak_ptr<BatchHub> hub;
+        BatchHub *key;
+        std::unique_ptr<ThreadBatch> batch;
+      };
+      std::vector<Entry> entries;
+
+      ~BatchTable()
+      {
+        //线程退出: 交出剩余数据并注销
+        for (auto &e : entries)
+        {
+          std::shared_ptr<BatchHub> hub = e.hub.lock();
+          if (!hub) continue;
+          std::unique_lock<std::mutex> hub_lock(hub->mutex);
+          if (hub->logger)
+          {
+            std::unique_lock<std::mutex> batch_lock(e.batch->mutex);
+            hub->logger->writeBatch(*e.batch);
+          }
+          auto &v = hub->batches;
+          v.erase(std::remove(v.begin(), v.end(), e.batch.get()), v.end());
+        }
+      }
+    };
+
+    ThreadBatch &localBatch()
+    {
+      static thread_local BatchTable table;
+      BatchHub *key = _hub.get();
+      for (auto &e : table.entries)
       {
-        sink->log(data, len);
+        //地址可能被新的日志器复用,以weak_ptr是否过期区分
+        if (e.key == key && !e.hub.expired()) return *e.batch;
       }
+      //清理已销毁日志器的表项
+      table.entries.erase(std::remove_if(table.entries.begin(), table.entries.end(),
+                                         [](const BatchTable::Entry &e){ return e.hub.expired(); }),
+                          table.entries.end());
+      BatchTable::Entry e;
+      e.hub = _hub;
+      e.key = key;
+      e.batch.reset(new ThreadBatch());
+      e.batch->buf.reserve(_batch_bytes + 1024);
+      ThreadBatch *batch = e.batch.get();
+      table.entries.push_back(std::move(e));
+      std::unique_lock<std::mutex> hub_lock(_hub->mutex);
+      _hub->batches.push_back(batch);
+      return *batch;
+    }
+
+    //持有hub.mutex调用
+    void drainAll()
+    {
+      for (auto *tb : _hub->batches)
+      {
+        std::unique_lock<std::mutex> batch_lock(tb->mutex);
+        writeBatch(*tb);
+      }
+    }
+
+    //持有batch.mutex调用
+    void writeBatch(ThreadBatch &tb)
+    {
+      if (tb.buf.empty()) return;
+      std::unique_lock<std::mutex> lock(_mutex);
+      _msgs_in.add(tb.msgs);
+      _bytes_in.add(tb.buf.size());
+      dispatch(tb.buf.data(), tb.buf.size());
+      tb.buf.clear();
+      tb.msgs = 0;
+    }
+
+    //持有_mutex调用: 单条或整批交给落地
+    void dispatch(const char *data, size_t len)
+    {
+      writeGroups(data, len, _group_bufs);
     }
+
+  public:
+    LoggerStats stats() override
+    {
+      LoggerStats st = Logger::stats();
+      st.msgs_in = _msgs_in.get();
+      st.bytes_in = _bytes_in.get();
+      return st;
+    }
+
+  private:
+    Counter _msgs_in;  // 在_mutex内更新
+    Counter _bytes_in;
+    std::vector<Buffer> _group_bufs; //多组时各组的批量缓冲区,在_mutex内访问
+
+    std::shared_ptr<BatchHub> _hub;  //批量模式,未开启时为空
+    size_t _batch_bytes = 0;
+    LogLevel::Value _flush_level = LogLevel::Value::WARN;
   };
 
 
@@ -207,30 +803,366 @@ namespace log
                   LogLevel::Value level,
                   Formatter::s_ptr& formatter,
                   std::vector<LogSink::s_ptr>& sinks,
-                  AsyncType asynctype = AsyncType::ASYNC_SAFE)
-          : Logger(logger_name, level, formatter, sinks),_looper(std::make_shared<AsyncLooper>(std::bind(&AsyncLogger::reallog,this,std::placeholders::_1),asynctype))
+                  AsyncType asynctype = AsyncType::ASYNC_SAFE,
+                  const LooperOptions& opts = LooperOptions())
+          : Logger(logger_name, level, formatter, sinks),_group_bufs(_groups.size()),_looper(std::make_shared<AsyncLooper>(std::bind(&AsyncLogger::reallog,this,std::placeholders::_1),asynctype,opts,
+                                                                                                         std::bind(&AsyncLogger::realflush,this,std::placeholders::_1)))
       {}
 
+      //工作器析构时写出剩余日志,重复汇总须在此之前入队
+      ~AsyncLogger(){ drainDup(); }
+
+      //高优先级通道: 不低于level的日志走AsyncLooper::pushUrgent; 须在开始写日志前调用
+      void enableUrgentLane(LogLevel::Value level){ _urgent_level = level; }
+
       //写到缓冲区中
+    using Logger::log;
     void log(const char *data, size_t len) override{
       _looper->push(data,len);
     }
+    void log(const char *data, size_t len, LogLevel::Value level) override{
+      struct iovec iov{const_cast<char*>(data),len};
+      logv(&iov,1,level);
+    }
+    void logv(const struct iovec *iov, int cnt, LogLevel::Value level) override{
+      if(level>=_urgent_level){
+        _looper->pushUrgent(iov,cnt,level>=LogLevel::Value::FATAL);
+        return;
+      }
+      _looper->pushv(iov,cnt);
+    }
     
     //实际日志输出
     void reallog(Buffer& buf){
       // std::unique_lock<std::mutex> lock(_mutex); //不需要锁,异步线程只有一个,是串行的
       if(_sinks.empty()){ return ; }
+      writeGroups(buf.begin(),buf.readAbleSize(),_group_bufs);
+    }
+
+    //在后台线程中刷新,与reallog串行
+    void realflush(bool fsync){
       for (auto &sink : _sinks) {
-        sink->log(buf.begin(),buf.readAbleSize());
+        sink->flush(fsync);
       }
     }
+
+    //由后台线程合并处理,future在此前入队的日志全部落地后就绪
+    std::future<void> flush(bool fsync = false) override{
+      drainDup();
+      return _looper->flush(fsync);
+    }
+
+    //入队统计由工作器负责,日志器不重复计数
+    LoggerStats stats() override{
+      LoggerStats st = Logger::stats();
+      st.async = true;
+      st.looper = _looper->stats();
+      st.msgs_in = st.looper.msgs_in;
+      st.bytes_in = st.looper.bytes_in;
+      return st;
+    }
     
     private:
+    std::vector<Buffer> _group_bufs; //多组时各组的批量缓冲区,只在后台线程访问
     AsyncLooper::s_ptr _looper;
+    LogLevel::Value _urgent_level = LogLevel::Value::OFF; //OFF表示不启用高优先级通道
 
   };
 
 
+  /*
+    分片异步日志器 -- 单个高频日志器的入队扩展
+    普通异步日志器所有生产者串行在一个AsyncLooper的_mutex上; 这里把生产者按线程分散到K个分片,
+    每个分片有自己的锁和缓冲区,生产者之间的竞争降为原来的约1/K
+
+    全局有序: 每条记录在分片锁内从全局计数器取得序号 seq,记录格式 [seq 8字节][len 4字节][数据]
+      同一分片内seq递增; 写出线程每轮:
+      1. 先读取全局计数器 G
+      2. 逐个分片加锁取走缓冲区 -- seq<G的记录在取号时已持有分片锁,释放锁前已写入,此时一定都已取到
+      3. K路归并,按seq顺序写出所有seq<G的记录; seq>=G的记录留到下一轮
+      输出与单个异步日志器一样按调用顺序全局有序
+
+    写出线程只有一个: 格式化在生产者线程完成,落地本身不是线程安全的,多个后台线程同时写同一个文件没有意义
+    LooperOptions中的线程名,绑定CPU,nice与SCHED_IDLE与AsyncLooper一样生效(applyLooperOptions); urgent_fsync不适用(没有高优先级通道)
+  */
+  class ShardedAsyncLogger : public Logger
+  {
+  public:
+    ShardedAsyncLogger(const std::string &logger_name,
+                       LogLevel::Value level,
+                       Formatter::s_ptr &formatter,
+                       std::vector<LogSink::s_ptr> &sinks,
+                       size_t shards,
+                       AsyncType asynctype = AsyncType::ASYNC_SAFE,
+                       const LooperOptions &opts = LooperOptions())
+        : Logger(logger_name, level, formatter, sinks), _group_bufs(_groups.size()), _shards(shards ? shards : 1),
+          _asynctype(asynctype), _opts(opts), _seq(0), _queued(0), _sleeping(false), _stop(false), _flush_fsync(false)
+    {
+      for (auto &shard : _shards)
+      {
+        shard.reset(new Shard());
+      }
+      _thread = std::thread(&ShardedAsyncLogger::threadEntry, this);
+    }
+
+    ~ShardedAsyncLogger()
+    {
+      drainDup();
+      {
+        std::unique_lock<std::mutex> lock(_wake_mutex);
+        _stop = true;
+      }
+      _wake.notify_all();
+      _thread.join();
+    }
+
+    using Logger::log;
+    void log(const char *data, size_t len) override
+    {
+      struct iovec iov{const_cast<char *>(data), len};
+      push(&iov, 1);
+    }
+    void logv(const struct iovec *iov, int cnt, LogLevel::Value level) override
+    {
+      (void)level;
+      push(iov, cnt);
+    }
+
+    //future在调用前写入的日志全部写出并刷新后就绪
+    std::future<void> flush(bool fsync = false) override
+    {
+      drainDup();
+      std::promise<void> done;
+      std::future<void> fut = done.get_future();
+      std::unique_lock<std::mutex> lock(_wake_mutex);
+      if (_stop)
+      {
+        done.set_value();
+        return fut;
+      }
+      _flush_reqs.push_back(std::move(done));
+      _flush_fsync = _flush_fsync || fsync;
+      _wake.notify_all();
+      return fut;
+    }
+
+    //每个分片一个折叠过滤器: 生产者不再汇聚到同一把折叠锁上
+    //只比较同一分片内相邻的记录,一个线程的重复风暴照常折叠; 多线程交替写同一条消息时每个分片各自汇总
+    void enableDedup(uint64_t window_ms) override
+    {
+      Logger::enableDedup(window_ms); //_dedup只作为开关
+      for (auto &shard : _shards)
+      {
+        shard->dedup.reset(window_ms ? new DupFilter(window_ms) : nullptr);
+      }
+    }
+
+    LoggerStats stats() override
+    {
+      LoggerStats st = Logger::stats();
+      st.async = true;
+      st.dedup_suppressed = 0;
+      for (auto &shard : _shards)
+      {
+        if (shard->dedup) st.dedup_suppressed += shard->dedup->suppressed();
+      }
+      st.looper = snapshot(_metrics);
+      st.msgs_in = st.looper.msgs_in;
+      st.bytes_in = st.looper.bytes_in;
+      return st;
+    }
+
+  private:
+    struct RecordHeader
+    {
+      uint64_t seq;
+      uint32_t len;
+    } __attribute__((packed));
+
+    struct Shard
+    {
+      std::mutex mutex;
+      std::condition_variable cond_pro; //安全模式下缓冲区满时生产者等待
+      Buffer pro;                       //生产者写入,在mutex内访问
+      Buffer con;                       //写出线程取走的记录,只在写出线程访问
+      Buffer carry;                     //上一轮留下的记录(seq>=G),序号都小于本轮的G,本轮先于con写出
+      std::unique_ptr<DupFilter> dedup; //本分片的重复折叠,未启用时为空
+      Shard() : carry(0) {}
+    };
+
+    DupFilter &dupFilter() override
+    {
+      return *localShard().dedup;
+    }
+
+    void drainDup() override
+    {
+      for (auto &shard : _shards)
+      {
+        DupSummary summary;
+        if (shard->dedup && shard->dedup->drain(summary))
+        {
+          emitDupSummary(summary);
+        }
+      }
+    }
+
+    //线程固定落在一个分片上,线程首次使用时轮流分配
+    Shard &localShard()
+    {
+      static std::atomic<size_t> next(0);
+      static thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed);
+      return *_shards[index % _shards.size()];
+    }
+
+    void push(const struct iovec *iov, int cnt)
+    {
+      size_t len = 0;
+      for (int i = 0; i < cnt; i++) len += iov[i].iov_len;
+      RecordHeader hdr;
+      hdr.len = (uint32_t)len;
+      Shard &shard = localShard();
+      {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        size_t need = sizeof(hdr) + len;
+        if (_asynctype == AsyncType::ASYNC_SAFE && need > shard.pro.writeAbleSize() && !shard.pro.empty())
+        {
+          uint64_t start = util::DateUtil::getSteadyNs();
+          shard.cond_pro.wait(lock, [&](){ return need <= shard.pro.writeAbleSize() || shard.pro.empty(); });
+          _metrics.producer_blocks.add();
+          _metrics.block_ns.add(util::DateUtil::getSteadyNs() - start);
+        }
+        //在分片锁内取号: 保证分片内序号递增,且取号后的记录在释放锁前已写入
+        hdr.seq = _seq.fetch_add(1, std::memory_order_seq_cst);
+        shard.pro.push(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        for (int i = 0; i < cnt; i++) shard.pro.push(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+        _metrics.msgs_in.add();
+        _metrics.bytes_in.add(len);
+        _metrics.high_water.max(shard.pro.readAbleSize());
+      }
+      //写出线程休眠时才唤醒,常规路径不碰_wake_mutex
+      _queued.fetch_add(1, std::memory_order_seq_cst);
+      if (_sleeping.load(std::memory_order_seq_cst))
+      {
+        std::unique_lock<std::mutex> lock(_wake_mutex);
+        _wake.notify_all();
+      }
+    }
+
+    void threadEntry()
+    {
+      applyLooperOptions(_opts, "ShardedAsyncLogger");
+      uint64_t handled = 0; //已取走的入队次数
+      while (true)
+      {
+        std::vector<std::promise<void>> flush_reqs;
+        bool fsync = false;
+        bool stop = false;
+        {
+          std::unique_lock<std::mutex> lock(_wake_mutex);
+          _sleeping.store(true, std::memory_order_seq_cst);
+          _wake.wait(lock, [&](){ return _queued.load(std::memory_order_seq_cst) != handled || _stop || !_flush_reqs.empty(); });
+          _sleeping.store(false, std::memory_order_relaxed);
+          flush_reqs.swap(_flush_reqs);
+          fsync = _flush_fsync;
+          _flush_fsync = false;
+          stop = _stop;
+        }
+        handled = _queued.load(std::memory_order_seq_cst);
+        //刷新请求之前写入的记录序号都小于G,本轮一定写出
+        mergeRound();
+        if (!flush_reqs.empty())
+        {
+          for (auto &sink : _sinks) sink->flush(fsync);
+          for (auto &req : flush_reqs) req.set_value();
+        }
+        if (stop && handled == _queued.load(std::memory_order_seq_cst))
+        {
+          mergeRound(); //停止后没有新的生产者,再取一轮保证写完
+          break;
+        }
+      }
+    }
+
+    //一轮: 读取G -> 取走各分片 -> 归并写出seq<G的记录
+    void mergeRound()
+    {
+      const uint64_t G = _seq.load(std::memory_order_seq_cst);
+      for (auto &shard : _shards)
+      {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        if (shard->pro.empty()) continue;
+        shard->con.swap(shard->pro); //上一轮结束时con已清空
+        shard->cond_pro.notify_all();
+      }
+      _metrics.swaps.add();
+
+      //K路归并: 小顶堆按各分片队首记录的seq
+      typedef std::pair<uint64_t, size_t> Head;
+      std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+      uint64_t seq;
+      for (size_t i = 0; i < _shards.size(); i++)
+      {
+        if (peek(*_shards[i], seq) && seq < G) heap.push(Head(seq, i));
+      }
+      while (!heap.empty())
+      {
+        size_t i = heap.top().second;
+        heap.pop();
+        Buffer &src = front(*_shards[i]);
+        RecordHeader hdr;
+        memcpy(&hdr, src.begin(), sizeof(hdr));
+        _out.push(src.begin() + sizeof(hdr), hdr.len);
+        src.moveReader(sizeof(hdr) + hdr.len);
+        if (peek(*_shards[i], seq) && seq < G) heap.push(Head(seq, i));
+      }
+      //seq>=G的记录(取号晚于G,数量很少)移入carry,下一轮写出
+      for (auto &shard : _shards)
+      {
+        shard->carry.reset(); //seq<G,本轮已写完
+        if (!shard->con.empty()) shard->carry.push(shard->con.begin(), shard->con.readAbleSize());
+        shard->con.reset();
+      }
+      if (!_out.empty())
+      {
+        writeGroups(_out.begin(), _out.readAbleSize(), _group_bufs);
+        _out.reset();
+      }
+    }
+
+    static Buffer &front(Shard &shard)
+    {
+      return shard.carry.empty() ? shard.con : shard.carry;
+    }
+
+    static bool peek(Shard &shard, uint64_t &seq)
+    {
+      Buffer &src = front(shard);
+      if (src.empty()) return false;
+      memcpy(&seq, src.begin(), sizeof(seq));
+      return true;
+    }
+
+  private:
+    std::vector<Buffer> _group_bufs; //多组时各组的批量缓冲区,只在写出线程访问
+    std::vector<std::unique_ptr<Shard>> _shards;
+    AsyncType _asynctype;
+    LooperOptions _opts;
+    Buffer _out;                     //归并结果,只在写出线程访问
+
+    std::atomic<uint64_t> _seq;      //全局序号
+    std::atomic<uint64_t> _queued;   //入队次数,写出线程据此判断有无新数据
+    std::atomic<bool> _sleeping;     //写出线程是否准备休眠
+    std::mutex _wake_mutex;
+    std::condition_variable _wake;
+    bool _stop;
+    std::vector<std::promise<void>> _flush_reqs; //在_wake_mutex内访问
+    bool _flush_fsync;
+    LooperMetrics _metrics;
+    std::thread _thread;             //最后声明
+  };
+
+
   enum class LoggerType
   {
     LOGGER_SYNC,
@@ -257,6 +1189,37 @@ namespace log
       void buildLoggerType(LoggerType logger_type ){_logger_type = logger_type;}
       void buildLoggerLevel(LogLevel::Value level ) { _limit_level = level; }
 
+      //异步线程调度选项,只对异步日志器有效
+      void buildBackendCpus(const std::vector<int>& cpus) { _looper_opts.cpus = cpus; }
+      void buildBackendNice(int nice) { _looper_opts.nice = nice; }
+      void buildBackendSchedIdle() { _looper_opts.sched_idle = true; }
+      void buildBackendThreadName(const std::string& name) { _looper_opts.name = name; }
+
+      //保留最近n条低于等级的记录(只拷贝参数,不格式化),ERROR/FATAL时先输出
+      void buildBacktrace(size_t n) { _backtrace_size = n; }
+
+      //重复消息折叠: 相邻的相同记录在window_ms内只输出一次并补一条"last message repeated N times"
+      //分片日志器按分片分别折叠(见ShardedAsyncLogger::enableDedup)
+      void buildDedup(uint64_t window_ms = 1000) { _dedup_window_ms = window_ms; }
+
+      //异步日志器分为k个分片(ShardedAsyncLogger),生产者按线程分散,写出时按序号归并
+      //不支持高优先级通道: 与buildPriorityLane同时使用时build()报错并终止
+      void buildShards(size_t k) { _shards = k; }
+
+      //异步日志器高优先级通道: 不低于level的日志不排在普通日志之后,后台优先写出并立即刷新(fsync可选); FATAL等到写出后才返回
+      void buildPriorityLane(LogLevel::Value level = LogLevel::Value::ERROR, bool fsync = false)
+      {
+        _urgent_level = level;
+        _looper_opts.urgent_fsync = fsync;
+      }
+
+      //同步日志器线程局部批量: 每个线程攒够batch_bytes或遇到不低于flush_level的日志时才持锁落地
+      void buildSyncBatching(size_t batch_bytes = 64 * 1024, LogLevel::Value flush_level = LogLevel::Value::WARN)
+      {
+        _sync_batch_bytes = batch_bytes;
+        _sync_flush_level = flush_level;
+      }
+
       void buildFormatter(const std::string &pattern )
       {
         _formatter_sp = std::make_shared<Formatter>(pattern);
@@ -269,8 +1232,56 @@ namespace log
           _sinks.push_back(sink_sp);
         }
 
+      //带独立格式的落地: 如文件用详细格式,控制台/网络用精简格式
+      template <class SinkType, class... Args>
+        void buildFormattedSink(const std::string &pattern, Args &&...args)
+        {
+          LogSink::s_ptr sink_sp = SinkFactory::create<SinkType>(std::forward<Args>(args)...);
+          sink_sp->setFormatter(std::make_shared<Formatter>(pattern));
+          _sinks.push_back(sink_sp);
+        }
+
       virtual Logger::s_ptr build() = 0;
 
+    protected:
+      Logger::s_ptr syncLogger()
+      {
+        std::shared_ptr<SyncLogger> logger = std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter_sp, _sinks);
+        if (_sync_batch_bytes)
+        {
+          logger->enableBatching(_sync_batch_bytes, _sync_flush_level);
+        }
+        return logger;
+      }
+
+      Logger::s_ptr asyncLogger()
+      {
+        if (_shards > 1)
+        {
+          //分片日志器没有高优先级通道,静默忽略会让FATAL在返回前不保证写出
+          if (_urgent_level != LogLevel::Value::OFF)
+          {
+            std::cout << "LoggerBuilder: buildPriorityLane与buildShards不能同时使用: " << _logger_name << std::endl;
+            abort();
+          }
+          return std::make_shared<ShardedAsyncLogger>(_logger_name,_limit_level,_formatter_sp,_sinks,_shards,_asynctype,looperOptions());
+        }
+        std::shared_ptr<AsyncLogger> logger = std::make_shared<AsyncLogger>(_logger_name,_limit_level,_formatter_sp,_sinks,_asynctype,looperOptions());
+        logger->enableUrgentLane(_urgent_level);
+        return logger;
+      }
+
+      //未指定线程名时默认为"xlog:日志器名"
+      LooperOptions looperOptions()
+      {
+        LooperOptions opts = _looper_opts;
+        if (opts.name.empty())
+        {
+          opts.name = "xlog:" + _logger_name;
+        }
+        return opts;
+      }
+
     protected:
       AsyncType _asynctype;
       std::atomic<LogLevel::Value> _limit_level;
@@ -278,6 +1289,13 @@ namespace log
       std::string _logger_name;
       Formatter::s_ptr _formatter_sp;
       std::vector<LogSink::s_ptr> _sinks; // 优化:使用set,保证唯一
+      LooperOptions _looper_opts;
+      size_t _backtrace_size = 0;
+      uint64_t _dedup_window_ms = 0;
+      size_t _sync_batch_bytes = 0; //0表示不开启同步批量
+      LogLevel::Value _sync_flush_level = LogLevel::Value::WARN;
+      LogLevel::Value _urgent_level = LogLevel::Value::OFF;
+      size_t _shards = 1;
   };
 
   class LocalLoggerBuilder : public LoggerBuilder
@@ -297,11 +1315,18 @@ namespace log
         {
           buildSink<StdoutSink>(); // 默认为标准输出
         }
+        Logger::s_ptr logger;
         if (_logger_type == LoggerType::LOGGER_ASYNC)
         {
-          return std::make_shared<AsyncLogger>(_logger_name,_limit_level,_formatter_sp,_sinks,_asynctype);
+          logger = asyncLogger();
+        }
+        else
+        {
+          logger = syncLogger();
         }
-        return std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter_sp, _sinks);
+        logger->enableBacktrace(_backtrace_size);
+        logger->enableDedup(_dedup_window_ms);
+        return logger;
       }
   };
 
@@ -328,18 +1353,32 @@ namespace log
         return _instance; 
       }
       void addLogger(Logger::s_ptr& logger){ //自动获取日志器名
-        if(hasLogger(logger->name()))
         std::lock_guard<std::mutex> lg(_mutex);
         _loggers.insert(std::make_pair(logger->name(),logger));
       }
 
       bool hasLogger(const std::string& name){
+        std::lock_guard<std::mutex> lg(_mutex);
         auto it = _loggers.find(name);
         return it==_loggers.end()? false:true; 
       }
 
       Logger::s_ptr getLogger(const std::string&name){
-        return hasLogger(name)? _loggers[name] :  nullptr;
+        std::lock_guard<std::mutex> lg(_mutex);
+        auto it = _loggers.find(name);
+        return it==_loggers.end()? nullptr:it->second;
+      }
+
+      //所有已注册日志器的运行指标快照,用于导出到监控
+      std::vector<LoggerStats> snapshotMetrics(){
+        std::vector<Logger::s_ptr> loggers;
+        {
+          std::lock_guard<std::mutex> lg(_mutex);
+          for(auto& it:_loggers) loggers.push_back(it.second);
+        }
+        std::vector<LoggerStats> out;
+        for(auto& logger:loggers) out.push_back(logger->stats());
+        return out;
       }
       
       Logger::s_ptr rootLogger(){
@@ -384,11 +1423,13 @@ namespace log
         Logger::s_ptr logger;
         if (_logger_type == LoggerType::LOGGER_ASYNC)
         {
-          logger =  std::make_shared<AsyncLogger>(_logger_name,_limit_level,_formatter_sp,_sinks,_asynctype);
+          logger =  asyncLogger();
         }
         else {
-          logger =  std::make_shared<SyncLogger>(_logger_name, _limit_level, _formatter_sp, _sinks);
+          logger = syncLogger();
         }
+        logger->enableBacktrace(_backtrace_size);
+        logger->enableDedup(_dedup_window_ms);
         log::LoggerManager::getInstance().addLogger(logger);
         return logger;
       }
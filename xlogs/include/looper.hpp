@@ -6,7 +6,19 @@
 #include<condition_variable>
 #include<atomic>
 #include<functional>
+#include<future>
+#include<vector>
+#include<string>
+#include<cstring>
+#include<pthread.h>
+#include<sched.h>
+#include<unistd.h>
+#include<sys/resource.h>
+#include<sys/syscall.h>
+#include<sys/uio.h>
 #include"buffer.hpp"
+#include"metrics.hpp"
+#include"util.hpp"
 
 namespace log{
 //异步工作器 looper:双缓冲循环
@@ -26,14 +38,69 @@ enum class AsyncType{
     
     
 using Functor = std::function<void(Buffer&)>; //处理缓冲区的任务
+using FlushFunctor = std::function<void(bool)>; //刷新各落地,参数为是否fsync
+
+/*
+  异步线程的调度选项 -- 让后台线程远离业务的热点核心
+  cpus:       绑定的CPU集合,空表示不绑定
+              绑定后两个缓冲区在后台线程内重新分配,首次写入发生在该线程所在的NUMA节点上
+              (之后缓冲区扩容由生产者线程触发,不保证本地性)
+  nice:       nice值,0表示不调整
+  sched_idle: 使用SCHED_IDLE调度策略,只在CPU空闲时运行(设置后nice无效)
+  name:       线程名(pthread_setname_np,最多15字节),便于top/perf中识别
+  设置失败只打印提示,不影响日志功能
+
+  urgent_fsync: 高优先级通道(pushUrgent)每批写出后是否fsync,默认只刷到内核
+*/
+struct LooperOptions{
+  std::vector<int> cpus;
+  int nice = 0;
+  bool sched_idle = false;
+  std::string name;
+  bool urgent_fsync = false;
+};
+
+//在后台线程内调用,设置本线程的名字,绑定与调度; who用于失败提示
+//AsyncLooper与ShardedAsyncLogger共用,保证构建器接受的选项都会生效
+inline void applyLooperOptions(const LooperOptions& opts,const char* who){
+  if(!opts.name.empty()){
+    pthread_setname_np(pthread_self(),opts.name.substr(0,15).c_str());
+  }
+  if(!opts.cpus.empty()){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu:opts.cpus) CPU_SET(cpu,&set);
+    int ret = pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+    if(ret!=0) std::cout<<who<<": 绑定CPU失败: "<<strerror(ret)<<"\n";
+  }
+  if(opts.sched_idle){
+    struct sched_param sp;
+    sp.sched_priority = 0;
+    int ret = pthread_setschedparam(pthread_self(),SCHED_IDLE,&sp);
+    if(ret!=0) std::cout<<who<<": 设置SCHED_IDLE失败: "<<strerror(ret)<<"\n";
+  }
+  else if(opts.nice!=0){
+    //Linux上nice值是线程级的,按线程id设置
+    if(setpriority(PRIO_PROCESS,(id_t)syscall(SYS_gettid),opts.nice)<0){
+      std::cout<<who<<": 设置nice失败: "<<strerror(errno)<<"\n";
+    }
+  }
+}
     class AsyncLooper{
     public:
         using s_ptr= std::shared_ptr<log::AsyncLooper>;
-        AsyncLooper(const Functor& callback,AsyncType looper_type = AsyncType::ASYNC_SAFE)
-        :_looper_type(looper_type),_stop(false),
-        _callback(callback),
+        static const size_t URGENT_BUFFER_SIZE = 64*1024; //高优先级通道初始大小,按需扩容
+        AsyncLooper(const Functor& callback,AsyncType looper_type = AsyncType::ASYNC_SAFE,const LooperOptions& opts = LooperOptions(),
+                    const FlushFunctor& flush_callback = FlushFunctor())
+        :_looper_type(looper_type),_stop(false),_started(false),
+        _callback(callback),_flush_callback(flush_callback),_flush_fsync(false),_opts(opts),
+        _buf_urgent(URGENT_BUFFER_SIZE),_buf_urgent_con(URGENT_BUFFER_SIZE),
         _thread(&AsyncLooper::threadEntry,this)
-        {}
+        {
+          //等待后台线程完成调度设置与缓冲区分配,之后才允许写入
+          std::unique_lock<std::mutex> lock(_mutex);
+          _cond_pro.wait(lock,[&](){ return _started; });
+        }
         
         ~AsyncLooper(){
           stop();
@@ -45,27 +112,88 @@ using Functor = std::function<void(Buffer&)>; //处理缓冲区的任务
            _thread.join(); 
         }
        
-//使用future? 代码更优雅
+        /*
+          刷新请求: 返回的future在 请求之前入队的数据全部交给回调处理 + 刷新回调执行完 后就绪
+          请求只是入队一个promise并唤醒后台线程; 后台下一次交换时取走所有待处理的请求,
+          处理完这一批数据后只执行一次刷新回调,多个并发请求合并为一次(任一请求要求fsync则fsync)
+        */
+        std::future<void> flush(bool fsync = false){
+          std::promise<void> done;
+          std::future<void> fut = done.get_future();
+          std::unique_lock<std::mutex> lock(_mutex);
+          if(_stop){ //后台线程已退出或即将退出,退出前会处理完全部数据
+            done.set_value();
+            return fut;
+          }
+          _flush_reqs.push_back(std::move(done));
+          _flush_fsync = _flush_fsync||fsync;
+          _cond_con.notify_all();
+          return fut;
+        }
 
         void push(const char* data, size_t len){
+          struct iovec iov{const_cast<char*>(data),len};
+          pushv(&iov,1);
+        }
+
+        //一条记录由多段组成(见Logger::payload): 持一次锁依次拷入缓冲区,各段连续,不与其他线程交错
+        void pushv(const struct iovec* iov, int cnt){
+          size_t len = 0;
+          for(int i = 0;i<cnt;i++) len += iov[i].iov_len;
 
           //1.无线扩容--非安全(用于压力测试) 2.阻塞--安全
           std::unique_lock<std::mutex> lock(_mutex);
           {
 
             //只针对阻塞模式,写满就休眠,等待唤醒;能写入就唤醒消费者 --- 只有生产者知道有没有数据
-            if(_looper_type == AsyncType::ASYNC_SAFE){
-              _cond_pro.wait(lock,[&](){return len>_buf_pro.writeAbleSize()?false:true;}); //一行代码决定是否安全模式
+            //超过缓冲区容量的单条记录(大payload)永远等不到足够空间: 等到缓冲区被取空后由push扩容写入
+            if(_looper_type == AsyncType::ASYNC_SAFE && len>_buf_pro.writeAbleSize() && !_buf_pro.empty()){
+              //只有真正要阻塞时才取时间,不阻塞的常规路径没有额外开销
+              uint64_t start = util::DateUtil::getSteadyNs();
+              _cond_pro.wait(lock,[&](){return len<=_buf_pro.writeAbleSize() || _buf_pro.empty();}); //一行代码决定是否安全模式
+              _metrics.producer_blocks.add();
+              _metrics.block_ns.add(util::DateUtil::getSteadyNs()-start);
             }
             // 性能: 输出很慢+写满阻塞时,性能影响严重; 输出速度>输入时,阻塞少,高性能. 
 
 
             //串行插入--线程安全
-            _buf_pro.push(data,len);
+            for(int i = 0;i<cnt;i++) _buf_pro.push(static_cast<const char*>(iov[i].iov_base),iov[i].iov_len);
+            _metrics.msgs_in.add();
+            _metrics.bytes_in.add(len);
+            _metrics.high_water.max(_buf_pro.readAbleSize());
             _cond_con.notify_all(); //保证是当前push线程,只唤醒一次;只有一个异步线程,只用于条件变量的锁
           }
         }
 
+        /*
+          高优先级通道(ERROR/FATAL): 与大批量的普通日志分开的小缓冲区
+          - 从不因缓冲区满而阻塞(按需扩容),不排在普通缓冲区之后
+          - 后台每轮先处理它,写出后立即执行一次刷新回调(fsync由urgent_fsync决定)
+          - wait为true时(FATAL)等到这一批写出并刷新后才返回,随后进程崩溃也不会丢失
+          代价: 与同一轮取走的普通日志相比,高优先级日志在输出中可能提前出现
+        */
+        void pushUrgent(const struct iovec* iov, int cnt, bool wait = false){
+          size_t len = 0;
+          for(int i = 0;i<cnt;i++) len += iov[i].iov_len;
+          std::future<void> done;
+          {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for(int i = 0;i<cnt;i++) _buf_urgent.push(static_cast<const char*>(iov[i].iov_base),iov[i].iov_len);
+            _metrics.msgs_in.add();
+            _metrics.bytes_in.add(len);
+            _metrics.urgent_msgs.add();
+            if(wait && !_stop){ //停止后后台线程仍会写完全部数据,但可能已经退出,不再等待
+              _urgent_waiters.emplace_back();
+              done = _urgent_waiters.back().get_future();
+            }
+            _cond_con.notify_all();
+          }
+          if(done.valid()) done.wait();
+        }
+
+        LooperStats stats() const { return snapshot(_metrics); }
+
         //异步任务线程入口
         /*
            双缓冲异步任务逻辑:
@@ -122,32 +250,77 @@ A B C
 
         //通过_stop控制线程任务的启停
         void threadEntry(){
+          applyOptions();
           while(1){
+            std::vector<std::promise<void>> flush_reqs;
+            std::vector<std::promise<void>> urgent_waiters;
+            bool fsync = false;
             {
               std::unique_lock<std::mutex> lock(_mutex);
               //保证停止前输出完所有数据 -- 只要有数据就不停止
 
-              if (_stop == true && _buf_pro.empty()) { break; }
+              if (_stop == true && _buf_pro.empty() && _buf_urgent.empty() && _flush_reqs.empty()) { break; }
               
               //运行时+生产缓冲区为空时阻塞;
               //_stop状态时,需要唤醒所有线程执行到被join,不然程序会休眠阻塞
-              _cond_con.wait(lock,[&](){return !_buf_pro.empty()||_stop;}); //捕获this
+              _cond_con.wait(lock,[&](){return !_buf_pro.empty()||!_buf_urgent.empty()||_stop||!_flush_reqs.empty();}); //捕获this
+
+              //高优先级通道一并取走
+              _buf_urgent_con.swap(_buf_urgent);
+              urgent_waiters.swap(_urgent_waiters);
 
               //走到这里,不为空,取走数据
               _buf_con.swap(_buf_pro);
+              _metrics.swaps.add();
+
+              //刷新请求之前入队的数据都在这一批中
+              flush_reqs.swap(_flush_reqs);
+              fsync = _flush_fsync;
+              _flush_fsync = false;
 
               //通知生产者 --- 锁内,保证是当前线程,只唤醒一次
               _cond_pro.notify_all();
             }
+            //1.先处理高优先级通道并立即刷新
+            if(!_buf_urgent_con.empty()){
+              _callback(_buf_urgent_con);
+              _buf_urgent_con.reset();
+              if(_flush_callback) _flush_callback(_opts.urgent_fsync);
+            }
+            for(auto& w:urgent_waiters) w.set_value();
+
             //2.数据处理,处理完毕后重置
-            _callback(_buf_con); // 数据处理由外界负责,不加锁 --- 只有一个线程,即串行化,不需要保护
+            if(!_buf_con.empty()) _callback(_buf_con); // 数据处理由外界负责,不加锁 --- 只有一个线程,即串行化,不需要保护
             _buf_con.reset();
+
+            //3.本批数据处理完,执行一次刷新,完成所有合并的请求
+            if(!flush_reqs.empty()){
+              if(_flush_callback) _flush_callback(fsync);
+              for(auto& req:flush_reqs) req.set_value();
+            }
           }
         }
 
+    private:
+        //在后台线程内执行
+        void applyOptions(){
+          applyLooperOptions(_opts,"AsyncLooper");
+
+          std::unique_lock<std::mutex> lock(_mutex);
+          if(!_opts.cpus.empty()){
+            //绑定后重新分配缓冲区: 由本线程完成首次写入,内存落在本地NUMA节点
+            Buffer pro,con;
+            _buf_pro.swap(pro);
+            _buf_con.swap(con);
+          }
+          _started = true;
+          _cond_pro.notify_all();
+        }
+
     private:
         AsyncType _looper_type; //安全类型|非安全类型
         std::atomic<bool> _stop; //启停标记
+        bool _started;           //后台线程完成初始化
 
         std::mutex _mutex; 
         std::condition_variable _cond_pro; //producer
@@ -155,10 +328,21 @@ A B C
 
 
         Functor _callback; //输出任务
-        std::thread _thread;    //异步输出任务线程
+        FlushFunctor _flush_callback; //刷新任务
+
+        std::vector<std::promise<void>> _flush_reqs; //待完成的刷新请求,在_mutex内访问
+        bool _flush_fsync;                           //待处理的请求中是否有要求fsync的
+        LooperOptions _opts; //后台线程调度选项
 
         Buffer _buf_pro; 
         Buffer _buf_con; //资源自动释放
+        Buffer _buf_urgent;     //高优先级通道,在_mutex内写入
+        Buffer _buf_urgent_con; //高优先级通道的消费侧,只在后台线程访问
+        std::vector<std::promise<void>> _urgent_waiters; //等待高优先级数据写出的生产者(FATAL),在_mutex内访问
+
+        LooperMetrics _metrics; //运行指标,在_mutex内更新
+
+        std::thread _thread;    //异步输出任务线程 -- 必须最后声明: 成员按声明顺序初始化,线程启动时其余成员需已构造完毕
     };
 
 }
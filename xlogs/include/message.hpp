@@ -3,7 +3,7 @@
 
 /*
   日志消息类,存储日志中间信息
-  1. 日志的输出时间   定位时间
+  1. 日志的输出时间   定位时间(纳秒精度)
   2. 日志等级         日志过滤
   3. 源文件名称       定位文件
   4. 源代码行号       定位行号
@@ -23,27 +23,44 @@ Exam:
 
 namespace log{
 
+  //LogMsg的文件名/日志器名参数: 接受C字符串与std::string左值,只取指针
+  //临时std::string在构造完成后即销毁,留下的指针悬空,因此直接拒绝(编译错误)
+  struct StrRef{
+    StrRef(const char* s):ptr(s){}
+    StrRef(const std::string& s):ptr(s.c_str()){}
+    StrRef(std::string&&) = delete;
+    const char* ptr;
+  };
+
   struct LogMsg{
 
     //日志优先级,文件,行号,日志器,数据
+    //文件名与日志器名只保存指针不拷贝: 长路径也不会在每次写日志时分配
+    //(文件名一般是__FILE__字面量,日志器名属于日志器)
     LogMsg(LogLevel::Value level,
-        const std::string filename,
+        StrRef filename,
         size_t line,
-        const std::string& loggername,
+        StrRef loggername,
         const std::string& msg)
-      :_time(util::DateUtil::getCurTime()),
-      _loggername(loggername),
+      :_time_ns(util::DateUtil::getCurTimeNs()),
+      _time(_time_ns/1000000000ull),
+      _loggername(loggername.ptr),
       _tid(std::this_thread::get_id()),
-      _filename(filename),
+      _thread(&util::ThreadUtil::current()),
+      _filename(filename.ptr),
       _line(line),
       _level(level),
       _payload(msg)
     { }
 
-    time_t _time;
-    std::string _loggername;
+    uint64_t _time_ns; //纳秒时间戳,用于亚秒级格式与排序
+    time_t _time;      //秒,由_time_ns得到
+    //_loggername与_filename不拥有所指的字符串: 调用方须保证它们在LogMsg使用期间(格式化结束前)一直有效,
+    //不要传入临时std::string的c_str(); 需要保存LogMsg时自行拷贝两个字符串(见BacktraceRing)
+    const char* _loggername;
     std::thread::id _tid;
-    std::string _filename;
+    const util::ThreadInfo* _thread; //线程信息缓存(预格式化的tid与线程名),只在产生日志的线程内有效
+    const char* _filename;
     size_t _line;
     LogLevel::Value _level;
     std::string _payload; //message
@@ -0,0 +1,109 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include<atomic>
+#include<string>
+#include<vector>
+#include<cstdint>
+
+/*
+  运行时自监控指标
+  : 日志系统自身的健康状况 -- 入队量,生产者阻塞,缓冲区水位,落地耗时,丢弃量
+
+  计数器一律使用relaxed原子操作: 只要求最终可见,不参与同步,开销与普通加法接近
+  大部分计数发生在已有的锁内(AsyncLooper::_mutex / SyncLogger::_mutex),不引入新的竞争
+  对外只提供快照(普通结构体),由LoggerManager::snapshotMetrics()汇总,便于导出到监控系统
+*/
+
+namespace log{
+
+  class Counter{
+    public:
+      Counter():_v(0){}
+      void add(uint64_t n = 1){ _v.fetch_add(n,std::memory_order_relaxed); }
+      //单调最大值 -- 水位线
+      void max(uint64_t n){
+        uint64_t cur = _v.load(std::memory_order_relaxed);
+        while(n>cur && !_v.compare_exchange_weak(cur,n,std::memory_order_relaxed)){}
+      }
+      uint64_t get() const { return _v.load(std::memory_order_relaxed); }
+    private:
+      std::atomic<uint64_t> _v;
+  };
+
+  //异步工作器指标 -- 在_mutex内更新
+  struct LooperMetrics{
+    Counter msgs_in;          //入队条数
+    Counter bytes_in;         //入队字节数
+    Counter producer_blocks;  //生产者因缓冲区满在_cond_pro上阻塞的次数
+    Counter block_ns;         //生产者阻塞总时长
+    Counter swaps;            //缓冲区交换次数
+    Counter high_water;       //生产缓冲区最高水位(字节)
+    Counter urgent_msgs;      //走高优先级通道的条数
+  };
+
+  //落地指标 -- 由LogSink::write更新
+  struct SinkMetrics{
+    Counter writes;           //落地调用次数
+    Counter bytes;            //落地字节数
+    Counter write_ns;         //落地总耗时(单条记录抽样计时,按比例估算; 批量写每次计时)
+    Counter max_write_ns;     //单次落地最大耗时(计时的调用中)
+    Counter drops;            //丢弃的字节数(落地方式自行统计,如网络不可达/共享内存环满)
+  };
+
+  //---------------------- 快照 ----------------------
+  struct LooperStats{
+    uint64_t msgs_in = 0;
+    uint64_t bytes_in = 0;
+    uint64_t producer_blocks = 0;
+    uint64_t block_ns = 0;
+    uint64_t swaps = 0;
+    uint64_t high_water = 0;
+    uint64_t urgent_msgs = 0;
+  };
+
+  struct SinkStats{
+    std::string type;         //落地类型名
+    uint64_t writes = 0;
+    uint64_t bytes = 0;
+    uint64_t write_ns = 0;
+    uint64_t max_write_ns = 0;
+    uint64_t drops = 0;
+  };
+
+  struct LoggerStats{
+    std::string name;
+    bool async = false;
+    uint64_t msgs_in = 0;     //通过等级过滤并完成格式化的条数
+    uint64_t bytes_in = 0;    //格式化后的字节数
+    uint64_t dedup_suppressed = 0; //重复折叠而未输出的条数
+    LooperStats looper;       //仅异步日志器有效
+    std::vector<SinkStats> sinks;
+  };
+
+  inline LooperStats snapshot(const LooperMetrics& m){
+    LooperStats s;
+    s.msgs_in = m.msgs_in.get();
+    s.bytes_in = m.bytes_in.get();
+    s.producer_blocks = m.producer_blocks.get();
+    s.block_ns = m.block_ns.get();
+    s.swaps = m.swaps.get();
+    s.high_water = m.high_water.get();
+    s.urgent_msgs = m.urgent_msgs.get();
+    return s;
+  }
+
+  inline SinkStats snapshot(const SinkMetrics& m,const std::string& type){
+    SinkStats s;
+    s.type = type;
+    s.writes = m.writes.get();
+    s.bytes = m.bytes.get();
+    s.write_ns = m.write_ns.get();
+    s.max_write_ns = m.max_write_ns.get();
+    s.drops = m.drops.get();
+    return s;
+  }
+
+} //namespace_log_END
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef NET_SINK_HPP
+#define NET_SINK_HPP
+
+#include<iostream>
+#include<string>
+#include<vector>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<chrono>
+#include<cstring>
+#include<cerrno>
+
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<netdb.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<sys/socket.h>
+#include<sys/uio.h>
+
+#include"sink.hpp"
+
+/*
+  网络落地 -- 将日志批量发往收集端(TCP/UDP)
+
+  1. 批量: 异步日志器每次交给落地的是整个交换出来的缓冲区,一次sendmsg(iov: 积压数据+本批数据)发出
+           UDP按行切分打包成不超过max_datagram的报文,sendmmsg一次发送多个
+  2. 非阻塞: socket为非阻塞,发不完的部分放入积压区,写日志的线程从不等待网络
+  3. 积压区有上限: 超出的整条记录丢弃,计入指标drops;已发出一半的记录总会补全,保证TCP流中不出现半行
+  4. 断线重连: 非阻塞connect,失败后按 100ms,200ms,...,最多30s 退避重试
+  5. 后台线程: 没有新日志时也定期尝试重连并发送积压数据
+*/
+
+namespace log{
+
+  enum class NetProto{
+    TCP,
+    UDP
+  };
+
+  class NetSink : public LogSink{
+    public:
+      NetSink(const std::string& host,uint16_t port,NetProto proto = NetProto::TCP,
+              size_t max_spill = 64*1024*1024,size_t max_datagram = 1472)
+        :_host(host),_port(port),_proto(proto),_max_spill(max_spill),_max_datagram(max_datagram),
+         _fd(-1),_connecting(false),_mid_record(false),_backoff_ms(0),_next_retry(0),_spill_off(0),_stop(false)
+      {
+        resolve();
+        connectPeer();
+        _thread = std::thread(&NetSink::threadEntry,this);
+      }
+
+      ~NetSink(){
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _stop = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+        //退出前尽力发送一次积压数据
+        std::unique_lock<std::mutex> lock(_mutex);
+        flushSpill();
+        closePeer();
+      }
+
+      void log(const char *data,size_t len) override{
+        std::unique_lock<std::mutex> lock(_mutex);
+        if(_fd<0 || _connecting) connectPeer();
+        if(_fd<0 || _connecting){
+          spill(data,len,false);
+          return;
+        }
+        if(_proto==NetProto::UDP) sendDatagrams(data,len);
+        else sendStream(data,len);
+      }
+
+      //尽力发送积压数据,不等待网络
+      void flush(bool fsync) override{
+        (void)fsync;
+        std::unique_lock<std::mutex> lock(_mutex);
+        if(_fd<0 || _connecting) connectPeer();
+        flushSpill();
+      }
+
+    private:
+      //---------------------- 连接管理 ----------------------
+      void resolve(){
+        struct addrinfo hints;
+        memset(&hints,0,sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = _proto==NetProto::TCP? SOCK_STREAM:SOCK_DGRAM;
+        struct addrinfo* res = nullptr;
+        int ret = getaddrinfo(_host.c_str(),std::to_string(_port).c_str(),&hints,&res);
+        if(ret!=0 || res==nullptr){
+          std::cout<<"NetSink: 地址解析失败: "<<_host<<":"<<_port<<"\n";
+          abort();
+        }
+        memcpy(&_addr,res->ai_addr,res->ai_addrlen);
+        _addrlen = res->ai_addrlen;
+        _family = res->ai_family;
+        freeaddrinfo(res);
+      }
+
+      //发起或检查非阻塞连接; 调用方持有_mutex
+      void connectPeer(){
+        if(_connecting){
+          struct pollfd pfd{_fd,POLLOUT,0};
+          if(poll(&pfd,1,0)<=0) return; //仍在连接中
+          int err = 0;
+          socklen_t elen = sizeof(err);
+          getsockopt(_fd,SOL_SOCKET,SO_ERROR,&err,&elen);
+          if(err!=0){ connectFailed(); return; }
+          connected();
+          return;
+        }
+        if(util::DateUtil::getSteadyNs()<_next_retry) return; //退避中
+
+        int type = (_proto==NetProto::TCP? SOCK_STREAM:SOCK_DGRAM)|SOCK_NONBLOCK|SOCK_CLOEXEC;
+        _fd = socket(_family,type,0);
+        if(_fd<0){ connectFailed(); return; }
+        if(_proto==NetProto::TCP){
+          int one = 1;
+          setsockopt(_fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one)); //已经是批量发送,不需要Nagle再攒
+        }
+        //UDP connect只是绑定默认对端,立即完成
+        if(connect(_fd,(struct sockaddr*)&_addr,_addrlen)==0){ connected(); return; }
+        if(errno==EINPROGRESS){ _connecting = true; return; }
+        connectFailed();
+      }
+
+      void connected(){
+        _connecting = false;
+        _backoff_ms = 0;
+        //上一个连接断在记录中间: 丢掉积压区中这条记录的剩余部分,新连接从完整的一行开始
+        if(_mid_record){
+          const char* begin = _spill.data()+_spill_off;
+          const char* nl = static_cast<const char*>(memchr(begin,'\n',_spill.size()-_spill_off));
+          size_t skip = nl? nl-begin+1:_spill.size()-_spill_off;
+          _metrics.drops.add(skip);
+          consumeSpill(skip);
+          _mid_record = false;
+        }
+      }
+
+      void connectFailed(){
+        closePeer();
+        _backoff_ms = _backoff_ms==0? 100:std::min<uint64_t>(_backoff_ms*2,30000);
+        _next_retry = util::DateUtil::getSteadyNs()+_backoff_ms*1000000ull;
+      }
+
+      void closePeer(){
+        if(_fd>=0) close(_fd);
+        _fd = -1;
+        _connecting = false;
+      }
+
+      //---------------------- 发送 ----------------------
+      //TCP: 积压数据与本批数据一次sendmsg发出,发不完的进入积压区
+      void sendStream(const char* data,size_t len){
+        struct iovec iov[2];
+        int cnt = 0;
+        size_t spilled = _spill.size()-_spill_off;
+        if(spilled){ iov[cnt].iov_base = &_spill[_spill_off]; iov[cnt].iov_len = spilled; cnt++; }
+        if(len){ iov[cnt].iov_base = const_cast<char*>(data); iov[cnt].iov_len = len; cnt++; }
+        if(cnt==0) return;
+
+        struct msghdr msg;
+        memset(&msg,0,sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(_fd,&msg,MSG_DONTWAIT|MSG_NOSIGNAL);
+        if(n<0){
+          if(errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) connectFailed();
+          spill(data,len,false);
+          return;
+        }
+        size_t sent = n;
+        size_t from_spill = std::min(sent,spilled);
+        if(from_spill){
+          _mid_record = _spill[_spill_off+from_spill-1]!='\n';
+          consumeSpill(from_spill);
+        }
+        size_t from_data = sent-from_spill;
+        if(from_data){
+          _mid_record = data[from_data-1]!='\n';
+        }
+        if(from_data<len) spill(data+from_data,len-from_data,from_data>0);
+      }
+
+      //UDP: 按行打包,每个报文不超过_max_datagram,sendmmsg批量发送
+      void sendDatagrams(const char* data,size_t len){
+        if(len) spill(data,len,false); //统一从积压区发送,未发出的自然留在积压区
+        const size_t batch = 64;
+        while(_spill.size()>_spill_off){
+          std::vector<struct mmsghdr> msgs;
+          std::vector<struct iovec> iovs;
+          msgs.reserve(batch);
+          iovs.reserve(batch);
+          size_t off = _spill_off;
+          while(off<_spill.size() && iovs.size()<batch){
+            size_t end = datagramEnd(off);
+            struct iovec iov;
+            iov.iov_base = &_spill[off];
+            iov.iov_len = end-off;
+            iovs.push_back(iov);
+            off = end;
+          }
+          for(auto& iov:iovs){
+            struct mmsghdr m;
+            memset(&m,0,sizeof(m));
+            m.msg_hdr.msg_iov = &iov;
+            m.msg_hdr.msg_iovlen = 1;
+            msgs.push_back(m);
+          }
+          int n = sendmmsg(_fd,msgs.data(),msgs.size(),MSG_DONTWAIT|MSG_NOSIGNAL);
+          if(n<=0){
+            if(n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) connectFailed();
+            return;
+          }
+          size_t sent = 0;
+          for(int i = 0;i<n;i++) sent += iovs[i].iov_len;
+          consumeSpill(sent);
+        }
+      }
+
+      //从off开始的一个报文的结束位置: 尽量装满,在行尾切分;单行超长时截断切分
+      size_t datagramEnd(size_t off){
+        size_t limit = std::min(_spill.size(),off+_max_datagram);
+        if(limit==_spill.size()) return limit;
+        const char* begin = _spill.data()+off;
+        const char* nl = static_cast<const char*>(memrchr(begin,'\n',limit-off));
+        return nl? nl-_spill.data()+1:limit;
+      }
+
+      //写入积压区; partial表示本批数据已经发出一部分,剩余的当前记录必须保留
+      void spill(const char* data,size_t len,bool partial){
+        size_t pending = _spill.size()-_spill_off;
+        if(pending+len<=_max_spill){
+          _spill.append(data,len);
+          return;
+        }
+        size_t keep = 0;
+        if(partial){ //补全已发出一半的记录
+          const char* nl = static_cast<const char*>(memchr(data,'\n',len));
+          keep = nl? nl-data+1:len;
+        }
+        else if(pending<_max_spill){ //尽量放入整行
+          const char* last = static_cast<const char*>(memrchr(data,'\n',_max_spill-pending));
+          keep = last? last-data+1:0;
+        }
+        _spill.append(data,keep);
+        _metrics.drops.add(len-keep);
+      }
+
+      void consumeSpill(size_t n){
+        _spill_off += n;
+        if(_spill_off==_spill.size()){
+          _spill.clear();
+          _spill_off = 0;
+        }
+        else if(_spill_off>_spill.size()/2){ //前半部分已发出,整理一次,避免只增不减
+          _spill.erase(0,_spill_off);
+          _spill_off = 0;
+        }
+      }
+
+      void flushSpill(){
+        if(_fd<0 || _connecting || _spill.size()==_spill_off) return;
+        if(_proto==NetProto::UDP) sendDatagrams(nullptr,0);
+        else sendStream(nullptr,0);
+      }
+
+      //后台: 定期重连并发送积压数据
+      void threadEntry(){
+        std::unique_lock<std::mutex> lock(_mutex);
+        while(!_stop){
+          _cond.wait_for(lock,std::chrono::milliseconds(50));
+          if(_stop) break;
+          if(_spill.size()==_spill_off && _fd>=0 && !_connecting) continue;
+          if(_fd<0 || _connecting) connectPeer();
+          flushSpill();
+        }
+      }
+
+    private:
+      std::string _host;
+      uint16_t _port;
+      NetProto _proto;
+      size_t _max_spill;       //积压区上限
+      size_t _max_datagram;    //UDP单个报文上限
+
+      struct sockaddr_storage _addr;
+      socklen_t _addrlen;
+      int _family;
+
+      int _fd;
+      bool _connecting;
+      bool _mid_record;        //已发出的数据是否停在一条记录中间
+      uint64_t _backoff_ms;
+      uint64_t _next_retry;    //下次重连时间(steady ns)
+
+      std::string _spill;      //积压区
+      size_t _spill_off;       //积压区中已发出部分
+
+      std::mutex _mutex;
+      std::condition_variable _cond;
+      bool _stop;
+      std::thread _thread;
+  };
+
+} //namespace_log_END
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef RETENTION_HPP
+#define RETENTION_HPP
+
+#include<iostream>
+#include<string>
+#include<deque>
+#include<vector>
+#include<memory>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<algorithm>
+#include<chrono>
+#include<cstdint>
+#include<ctime>
+#include<cctype>
+
+#include<unistd.h>
+#include<dirent.h>
+#include<sys/stat.h>
+
+#include"util.hpp"
+
+/*
+  滚动日志保留策略
+  : 滚动落地只会不断创建新文件,需要按 文件数 / 总字节数 / 最长保留时间 清理旧文件
+
+  设计:
+  - 滚动落地在切换文件时告知管理器(新文件开始写入,旧文件的最终大小),管理器在内存中维护文件列表
+  - 清理在后台线程中进行,写日志的线程只是入队一条记录,不扫描目录,不删除文件
+  - 正在写入的文件永远不删除
+  - 构造时扫描一次目录,接管上次运行留下的同格式文件(前缀+时间戳[-编号]+.log),之后不再扫描
+*/
+
+namespace log{
+
+  struct RetentionPolicy{
+    size_t max_files;    //最多保留的文件数(含正在写入的文件),0表示不限
+    uint64_t max_bytes;  //所有文件的总大小上限,0表示不限
+    time_t max_age;      //文件最后写入后保留的秒数,0表示不限
+
+    RetentionPolicy(size_t files = 0,uint64_t bytes = 0,time_t age = 0)
+      :max_files(files),max_bytes(bytes),max_age(age){}
+
+    bool enabled() const { return max_files||max_bytes||max_age; }
+  };
+
+  class RetentionManager{
+    public:
+      using s_ptr = std::shared_ptr<log::RetentionManager>;
+
+      //basename: 滚动落地的文件名前缀,用于启动时接管已有文件
+      //须在滚动落地创建本次运行的第一个文件之前构造
+      RetentionManager(const std::string& basename,const RetentionPolicy& policy)
+        :_basename(basename),_policy(policy),_stop(false)
+      {
+        adoptExisting(); //只在构造时扫描一次目录
+        _thread = std::thread(&RetentionManager::threadEntry,this);
+      }
+
+      ~RetentionManager(){
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _stop = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+      }
+
+      //开始写入新文件; prev_size为上一个文件的最终大小
+      void segmentOpened(const std::string& path,uint64_t prev_size){
+        std::unique_lock<std::mutex> lock(_mutex);
+        _events.push_back(Event{path,prev_size,time(nullptr)});
+        _cond.notify_all();
+      }
+
+    private:
+      struct Segment{
+        std::string path;
+        uint64_t size;
+        time_t closed; //最后写入时间
+      };
+      struct Event{
+        std::string path;
+        uint64_t prev_size;
+        time_t when;
+      };
+
+      void threadEntry(){
+        enforce(); //接管的旧文件先按策略清理一次
+        while(true){
+          std::vector<Event> events;
+          {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto ready = [&](){ return _stop||!_events.empty(); };
+            if(_policy.max_age && !_closed.empty()){
+              //有时间限制时,最迟在最旧文件过期时醒来
+              time_t expire = _closed.front().closed+_policy.max_age;
+              _cond.wait_until(lock,std::chrono::system_clock::from_time_t(expire),ready);
+            }
+            else{
+              _cond.wait(lock,ready);
+            }
+            if(_stop) break;
+            events.swap(_events);
+          }
+          for(auto& ev:events){
+            if(!_active.empty()){
+              _closed.push_back(Segment{_active,ev.prev_size,ev.when});
+            }
+            _active = ev.path;
+            //重新打开已有文件(如重启后仍在同一时间窗口内): 它已作为旧文件被接管,移出已关闭列表
+            _closed.erase(std::remove_if(_closed.begin(),_closed.end(),[&](const Segment& seg){ return seg.path==_active; }),_closed.end());
+          }
+          enforce();
+        }
+      }
+
+      //按策略删除最旧的文件,直到满足全部限制
+      void enforce(){
+        time_t now = time(nullptr);
+        uint64_t total = 0;
+        for(auto& seg:_closed) total += seg.size;
+        size_t files = _closed.size()+(_active.empty()? 0:1);
+
+        while(!_closed.empty()){
+          const Segment& oldest = _closed.front();
+          bool over_files = _policy.max_files && files>_policy.max_files;
+          bool over_bytes = _policy.max_bytes && total>_policy.max_bytes;
+          bool over_age = _policy.max_age && now-oldest.closed>=_policy.max_age;
+          if(!over_files && !over_bytes && !over_age) break;
+          if(oldest.path==_active){
+            //正在写入的文件永远不删除
+          }
+          else if(unlink(oldest.path.c_str())<0 && util::FileUtil::exists(oldest.path)){
+            std::cout<<"RetentionManager: 删除文件失败: "<<oldest.path<<"\n";
+          }
+          total -= oldest.size;
+          files--;
+          _closed.pop_front();
+        }
+      }
+
+      //是否为滚动落地生成的文件名: 前缀 + 时间戳[-编号] + ".log"
+      //只看前缀不够: 前缀为空(basename以'/'结尾)时会接管目录下所有文件,包括其他落地的文件
+      static bool generatedName(const std::string& name,const std::string& prefix){
+        if(name.size()<=prefix.size() || name.compare(0,prefix.size(),prefix)!=0) return false;
+        size_t i = prefix.size();
+        auto digits = [&](){
+          size_t from = i;
+          while(i<name.size() && isdigit((unsigned char)name[i])) i++;
+          return i>from;
+        };
+        if(!digits()) return false;
+        if(i<name.size() && name[i]=='-'){
+          i++;
+          if(!digits()) return false;
+        }
+        return name.compare(i,std::string::npos,".log")==0;
+      }
+
+      //启动时接管同目录下同前缀的旧文件,按修改时间排序
+      void adoptExisting(){
+        std::string dir = util::FileUtil::getPath(_basename);
+        std::string prefix = _basename.substr(_basename.find_last_of("/\\")==std::string::npos? 0:_basename.find_last_of("/\\")+1);
+        DIR* dp = opendir(dir.c_str());
+        if(dp==nullptr) return;
+        std::vector<std::pair<uint64_t,Segment>> found; //按纳秒级修改时间排序,同一秒内滚动的文件也能排出先后
+        struct dirent* ent;
+        while((ent = readdir(dp))!=nullptr){
+          std::string name = ent->d_name;
+          if(!generatedName(name,prefix)) continue;
+          std::string path = dir==""||dir[dir.size()-1]=='/'? dir+name:dir+"/"+name;
+          struct stat st;
+          if(stat(path.c_str(),&st)<0 || !S_ISREG(st.st_mode)) continue;
+          uint64_t mtime_ns = (uint64_t)st.st_mtim.tv_sec*1000000000ull+st.st_mtim.tv_nsec;
+          found.push_back(std::make_pair(mtime_ns,Segment{path,(uint64_t)st.st_size,st.st_mtime}));
+        }
+        closedir(dp);
+        std::sort(found.begin(),found.end(),[](const std::pair<uint64_t,Segment>& a,const std::pair<uint64_t,Segment>& b){ return a.first<b.first; });
+        for(auto& it:found) _closed.push_back(it.second);
+      }
+
+    private:
+      std::string _basename;
+      RetentionPolicy _policy;
+
+      std::mutex _mutex;
+      std::condition_variable _cond;
+      bool _stop;
+      std::vector<Event> _events;     //待处理的切换记录
+
+      //以下只在后台线程访问
+      std::deque<Segment> _closed;    //已关闭的文件,旧->新
+      std::string _active;            //正在写入的文件
+
+      std::thread _thread;
+  };
+
+} //namespace_log_END
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef SHM_SINK_HPP
+#define SHM_SINK_HPP
+
+#include<iostream>
+#include<string>
+#include<atomic>
+#include<functional>
+#include<cstring>
+#include<cstdint>
+
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include"sink.hpp"
+
+/*
+  共享内存环形缓冲区落地 -- 把文件IO移出业务进程
+  业务进程只把日志拷入共享内存环,由独立的xlog-shipper进程取出并用已有落地方式写文件
+
+  共享段布局(shm_open + mmap):
+    [ShmRingHeader][data: capacity字节]
+  每条记录: [RecordHeader 16字节][数据][填充到16字节对齐]
+
+  无锁多生产者单消费者:
+  1. 预留: 生产者CAS推进head,得到独占区间;空间不足直接丢弃(计入drops),从不等待消费者
+  2. 写入: 拷贝数据后以release写入记录头的stamp(= 记录绝对位置+1),表示提交
+  3. 消费: 消费者按tail顺序读取,stamp等于tail+1才是已提交的记录;绝对位置不会重复,旧数据不会被误认为已提交
+  4. 回绕: 记录不跨越缓冲区末尾,剩余空间写一条填充记录
+  5. 多进程可同时作为生产者(同名共享段),只能有一个消费者
+
+  应用崩溃时: 已提交的记录仍在共享段中,shipper照常取出; 预留后未提交的记录超时后被跳过
+  注: glibc 2.34以前shm_open位于librt,需要链接-lrt
+*/
+
+namespace log{
+
+  struct ShmRingHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;                    //数据区字节数,2的幂
+    std::atomic<uint32_t> ready;          //创建者初始化完成
+    alignas(64) std::atomic<uint64_t> head;   //生产者预留位置
+    alignas(64) std::atomic<uint64_t> tail;   //消费者读取位置
+    alignas(64) std::atomic<uint64_t> drops;  //环满丢弃的字节数(所有生产者)
+    std::atomic<uint64_t> skipped;            //超时未提交而被跳过的字节数
+  };
+
+  class ShmRing{
+    public:
+      static const uint32_t MAGIC = 0x786c6f67; //"xlog"
+      static const uint32_t VERSION = 1;
+      static const uint64_t ALIGN = 16;
+
+      //打开(不存在则创建)名为name的共享段; capacity向上取整为2的幂,已存在时以已有段为准
+      ShmRing(const std::string& name,size_t capacity = 64*1024*1024)
+        :_name(name),_hdr(nullptr),_data(nullptr),_map_size(0),_stuck_pos(UINT64_MAX),_stuck_since(0)
+      {
+        uint64_t cap = 4096;
+        while(cap<capacity) cap <<= 1;
+
+        bool creator = true;
+        int fd = shm_open(name.c_str(),O_RDWR|O_CREAT|O_EXCL,0644);
+        if(fd<0 && errno==EEXIST){
+          creator = false;
+          fd = shm_open(name.c_str(),O_RDWR,0644);
+        }
+        if(fd<0){
+          std::cout<<"ShmRing: 共享内存打开失败: "<<name<<": "<<strerror(errno)<<"\n";
+          abort();
+        }
+        if(creator){
+          _map_size = sizeof(ShmRingHeader)+cap;
+          if(ftruncate(fd,_map_size)<0){
+            std::cout<<"ShmRing: 共享内存大小设置失败: "<<strerror(errno)<<"\n";
+            abort();
+          }
+        }
+        else{
+          //等待创建者设置大小
+          struct stat st;
+          while(fstat(fd,&st)==0 && (size_t)st.st_size<sizeof(ShmRingHeader)) usleep(1000);
+          _map_size = st.st_size;
+        }
+        void* addr = mmap(nullptr,_map_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+        close(fd);
+        if(addr==MAP_FAILED){
+          std::cout<<"ShmRing: 共享内存映射失败: "<<strerror(errno)<<"\n";
+          abort();
+        }
+        _hdr = static_cast<ShmRingHeader*>(addr);
+        _data = static_cast<char*>(addr)+sizeof(ShmRingHeader);
+        if(creator){
+          _hdr->magic = MAGIC;
+          _hdr->version = VERSION;
+          _hdr->capacity = cap;
+          _hdr->head.store(0,std::memory_order_relaxed);
+          _hdr->tail.store(0,std::memory_order_relaxed);
+          _hdr->drops.store(0,std::memory_order_relaxed);
+          _hdr->skipped.store(0,std::memory_order_relaxed);
+          _hdr->ready.store(1,std::memory_order_release);
+        }
+        else{
+          while(_hdr->ready.load(std::memory_order_acquire)==0) usleep(1000);
+          if(_hdr->magic!=MAGIC || _hdr->version!=VERSION || sizeof(ShmRingHeader)+_hdr->capacity!=_map_size){
+            std::cout<<"ShmRing: 共享内存格式不匹配: "<<name<<"\n";
+            abort();
+          }
+        }
+      }
+
+      ~ShmRing(){
+        if(_hdr) munmap(_hdr,_map_size);
+      }
+
+      ShmRing(const ShmRing&) = delete;
+      ShmRing& operator=(const ShmRing&) = delete;
+
+      //删除共享段(已映射的进程不受影响)
+      static void unlink(const std::string& name){ shm_unlink(name.c_str()); }
+
+      uint64_t capacity() const { return _hdr->capacity; }
+      //单条记录的最大长度,更长的数据由调用方切分
+      uint64_t maxRecord() const { return _hdr->capacity/4; }
+      uint64_t drops() const { return _hdr->drops.load(std::memory_order_relaxed); }
+      uint64_t skipped() const { return _hdr->skipped.load(std::memory_order_relaxed); }
+      uint64_t pending() const {
+        return _hdr->head.load(std::memory_order_acquire)-_hdr->tail.load(std::memory_order_acquire);
+      }
+
+      //---------------------- 生产者 ----------------------
+      //发布一条记录; 环满返回false(已计入drops)
+      bool publish(const char* data,size_t len){
+        const uint64_t cap = _hdr->capacity;
+        const uint64_t need = align(sizeof(RecordHeader)+len);
+        uint64_t pos = _hdr->head.load(std::memory_order_relaxed);
+        uint64_t pad;
+        while(true){
+          uint64_t off = pos&(cap-1);
+          pad = off+need>cap? cap-off:0;
+          uint64_t tail = _hdr->tail.load(std::memory_order_acquire);
+          if(pos+pad+need-tail>cap){
+            _hdr->drops.fetch_add(len,std::memory_order_relaxed);
+            return false;
+          }
+          if(_hdr->head.compare_exchange_weak(pos,pos+pad+need,std::memory_order_acq_rel,std::memory_order_relaxed)) break;
+        }
+        if(pad){
+          RecordHeader* ph = record(pos);
+          ph->len = pad-sizeof(RecordHeader);
+          ph->type = PAD;
+          ph->stamp.store(pos+1,std::memory_order_release);
+          pos += pad;
+        }
+        RecordHeader* rh = record(pos);
+        rh->len = len;
+        rh->type = DATA;
+        memcpy(reinterpret_cast<char*>(rh)+sizeof(RecordHeader),data,len);
+        rh->stamp.store(pos+1,std::memory_order_release);
+        return true;
+      }
+
+      //---------------------- 消费者(唯一) ----------------------
+      //取出当前所有已提交的记录,逐条回调; 返回取出的数据字节数
+      //stuck_ms: 记录预留后超过该时间仍未提交(生产者崩溃),跳过它
+      size_t consume(const std::function<void(const char*,size_t)>& cb,uint64_t stuck_ms = 1000){
+        uint64_t pos = _hdr->tail.load(std::memory_order_relaxed);
+        uint64_t head = _hdr->head.load(std::memory_order_acquire);
+        size_t bytes = 0;
+        while(pos<head){
+          RecordHeader* rh = record(pos);
+          if(rh->stamp.load(std::memory_order_acquire)!=pos+1){
+            if(!stuck(pos,stuck_ms)) break;
+            pos = skip(pos,head);
+            continue;
+          }
+          uint64_t size = align(sizeof(RecordHeader)+rh->len);
+          if(rh->type==DATA){
+            cb(reinterpret_cast<char*>(rh)+sizeof(RecordHeader),rh->len);
+            bytes += rh->len;
+          }
+          pos += size;
+          //逐条释放空间,回调较慢时生产者也能尽早复用
+          _hdr->tail.store(pos,std::memory_order_release);
+        }
+        _hdr->tail.store(pos,std::memory_order_release);
+        return bytes;
+      }
+
+    private:
+      enum : uint32_t { DATA = 1, PAD = 2 };
+      struct RecordHeader{
+        std::atomic<uint64_t> stamp;  //提交标记: 记录绝对位置+1
+        uint32_t len;                 //数据长度(填充记录为填充长度)
+        uint32_t type;
+      };
+      static_assert(sizeof(RecordHeader)==16,"RecordHeader必须为16字节");
+
+      static uint64_t align(uint64_t n){ return (n+ALIGN-1)&~(ALIGN-1); }
+      RecordHeader* record(uint64_t pos){
+        return reinterpret_cast<RecordHeader*>(_data+(pos&(_hdr->capacity-1)));
+      }
+
+      //pos处的记录是否已卡住超过stuck_ms
+      bool stuck(uint64_t pos,uint64_t stuck_ms){
+        uint64_t now = util::DateUtil::getSteadyNs();
+        if(_stuck_pos!=pos){
+          _stuck_pos = pos;
+          _stuck_since = now;
+          return false;
+        }
+        return now-_stuck_since>=stuck_ms*1000000ull;
+      }
+
+      //跳过未提交的记录: 长度已写入且合理时按长度跳过,否则丢弃到head为止
+      uint64_t skip(uint64_t pos,uint64_t head){
+        RecordHeader* rh = record(pos);
+        uint64_t off = pos&(_hdr->capacity-1);
+        uint64_t size = align(sizeof(RecordHeader)+rh->len);
+        uint64_t next = (rh->type==DATA||rh->type==PAD) && off+size<=_hdr->capacity && pos+size<=head? pos+size:head;
+        _hdr->skipped.fetch_add(next-pos,std::memory_order_relaxed);
+        std::cout<<"ShmRing: 跳过未提交的记录 "<<next-pos<<" 字节\n";
+        _stuck_pos = UINT64_MAX;
+        return next;
+      }
+
+    private:
+      std::string _name;
+      ShmRingHeader* _hdr;
+      char* _data;
+      size_t _map_size;
+      uint64_t _stuck_pos;      //消费者: 正在等待提交的位置
+      uint64_t _stuck_since;
+  };
+
+  class ShmSink : public LogSink{
+    public:
+      //name: 共享段名称,如"/xlog"; 与xlog-shipper -n 参数一致
+      ShmSink(const std::string& name,size_t capacity = 64*1024*1024)
+        :_ring(name,capacity){}
+
+      void log(const char *data,size_t len) override{
+        //异步批量可能超过单条记录上限: 尽量在行尾切分
+        const size_t max = _ring.maxRecord();
+        while(len>max){
+          const char* nl = static_cast<const char*>(memrchr(data,'\n',max));
+          size_t n = nl? nl-data+1:max;
+          publish(data,n);
+          data += n;
+          len -= n;
+        }
+        if(len) publish(data,len);
+      }
+
+    private:
+      void publish(const char* data,size_t len){
+        if(!_ring.publish(data,len)) _metrics.drops.add(len);
+      }
+
+    private:
+      ShmRing _ring;
+  };
+
+} //namespace_log_END
+
+#endif
@@ -4,10 +4,31 @@
 
 #include"util.hpp"
 #include"message.hpp"
+#include"format.hpp"
+#include"metrics.hpp"
+#include"retention.hpp"
+#include"alloc_trace.hpp"
 #include<memory>
+#include<typeinfo>
+#include<cxxabi.h>
 #include<cassert>
 #include<fstream>
 #include<sstream>
+#include<vector>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<algorithm>
+
+#include<climits>
+#include<cstdlib>
+#include<cerrno>
+
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/file.h>
+#include<sys/uio.h>
+#include<poll.h>
 
 
 //日志落地模块 -- 指定输出位置
@@ -20,27 +41,237 @@ namespace log{
       virtual ~LogSink() {}
       virtual void log(const char *data, size_t len) = 0;
       //信息数据与长度
+
+      //把已写入的数据交给内核(用户态缓冲刷出); fsync为true时再落盘
+      //与log在同一线程调用(同步日志器持锁调用,异步日志器在后台线程调用)
+      virtual void flush(bool fsync = false){ (void)fsync; }
+
+      //分散写: 一条记录由多段组成(格式头,调用方的消息体,格式尾),见Logger::payload
+      //默认拼接后交给log(一次拷贝); 能直接写多段的落地重写,消息体不再拷贝
+      //各段属于同一条记录,重写时不能在段之间滚动文件等
+      virtual void logv(const struct iovec *iov, int cnt){
+        if(cnt==1){
+          log(static_cast<const char*>(iov[0].iov_base),iov[0].iov_len);
+          return;
+        }
+        static thread_local std::string joined;
+        joined.clear();
+        for(int i = 0;i<cnt;i++) joined.append(static_cast<const char*>(iov[i].iov_base),iov[i].iov_len);
+        log(joined.data(),joined.size());
+      }
+
+      //日志器统一通过write落地: 在log外围统计次数,字节数与耗时
+      //次数与字节数每次都计(relaxed自增); 耗时需要两次读时钟,只对批量写(异步整块,>=TIMED_BYTES)每次计时,
+      //单条记录(同步日志器每次调用)每SAMPLE_EVERY次抽样一次,write_ns按抽样比例估算
+      void write(const char *data, size_t len){
+        XLOG_ALLOC_SCOPE(SINK);
+        uint64_t scale = timingScale(len);
+        if(scale==0){
+          log(data,len);
+          count(len);
+          return;
+        }
+        uint64_t start = util::DateUtil::getSteadyNs();
+        log(data,len);
+        record(len,util::DateUtil::getSteadyNs()-start,scale);
+      }
+      void writev(const struct iovec *iov, int cnt){
+        XLOG_ALLOC_SCOPE(SINK);
+        size_t len = 0;
+        for(int i = 0;i<cnt;i++) len += iov[i].iov_len;
+        uint64_t scale = timingScale(len);
+        if(scale==0){
+          logv(iov,cnt);
+          count(len);
+          return;
+        }
+        uint64_t start = util::DateUtil::getSteadyNs();
+        logv(iov,cnt);
+        record(len,util::DateUtil::getSteadyNs()-start,scale);
+      }
+
+      SinkStats stats() const {
+        //类型名只在取快照时解析,不占用热路径
+        int status = 0;
+        char* name = abi::__cxa_demangle(typeid(*this).name(),nullptr,nullptr,&status);
+        std::string type = status==0? name:typeid(*this).name();
+        free(name);
+        return snapshot(_metrics,type);
+      }
+
+      //可选: 落地自己的格式化器,为空时使用日志器的格式化器
+      //须在构建日志器之前设置 -- 日志器构造时按格式分组
+      void setFormatter(const Formatter::s_ptr& formatter){ _formatter = formatter; }
+      const Formatter::s_ptr& formatter() const { return _formatter; }
+      //使用日志器的格式化器时,是否把其中的%p换成带颜色的%p{color}(如输出到终端的StdoutSink)
+      virtual bool colorLevel() const { return false; }
+
+    protected:
+      static const size_t TIMED_BYTES = 4096;
+      static const uint64_t SAMPLE_EVERY = 64;
+
+      //本次是否计时: 0不计时,否则为本次耗时计入write_ns的倍数
+      uint64_t timingScale(size_t len) const {
+        if(len>=TIMED_BYTES) return 1;
+        return _metrics.writes.get()%SAMPLE_EVERY==0? SAMPLE_EVERY:0;
+      }
+      void count(size_t len){
+        _metrics.writes.add();
+        _metrics.bytes.add(len);
+      }
+      void record(size_t len,uint64_t cost,uint64_t scale = 1){
+        count(len);
+        _metrics.write_ns.add(cost*scale);
+        _metrics.max_write_ns.max(cost);
+      }
+
+    protected:
+      SinkMetrics _metrics;
+      Formatter::s_ptr _formatter;
+  };
+
+  /*
+    StdoutSink -- 直接写fd 1/2,不经过iostream
+    std::cout.write每次都有sentry,locale与stdio同步的开销,输出到管道(容器日志驱动)时还会被切成小块
+      - 每次log一个write; 异步日志器交来的是整批数据,一批一次系统调用
+      - buffer_size>0: 自己缓冲,攒满后与本次数据一次writev写出(同步日志器大量小记录时使用)
+                       缓冲中的数据在flush或析构时写出,需要及时可见时不要开启
+      - 构造时检测一次是否为终端: 是终端且color为true时,日志等级带颜色(见 Logger::groupSinks)
+                       设置了环境变量NO_COLOR时不着色
+    注: 与程序自己的std::cout输出不再共用缓冲,两者之间的先后顺序不保证
+  */
+  enum class StdStream{
+    OUT = STDOUT_FILENO,
+    ERR = STDERR_FILENO
   };
 
   class StdoutSink:public LogSink{
     public:
-      StdoutSink()=default;
+      StdoutSink(StdStream stream = StdStream::OUT,bool color = true,size_t buffer_size = 0)
+        :_fd(static_cast<int>(stream)),_buffer_size(buffer_size)
+      {
+        _color = color && isatty(_fd) && getenv("NO_COLOR")==nullptr;
+        _buf.reserve(buffer_size);
+      }
+      ~StdoutSink(){
+        writeBuffered(nullptr,0);
+      }
       void log(const char *data,size_t len)override{
-        std::cout.write(data,len);
+        if(_buffer_size==0){
+          struct iovec iov{const_cast<char*>(data),len};
+          writeAll(&iov,1);
+          return;
+        }
+        if(_buf.size()+len<=_buffer_size){
+          _buf.append(data,len);
+          return;
+        }
+        writeBuffered(data,len);
+      }
+      //缓冲区中的数据在前,与各段一次writev写出
+      void logv(const struct iovec *iov,int cnt)override{
+        size_t len = 0;
+        for(int i = 0;i<cnt;i++) len += iov[i].iov_len;
+        if(_buffer_size>0 && _buf.size()+len<=_buffer_size){
+          for(int i = 0;i<cnt;i++) _buf.append(static_cast<const char*>(iov[i].iov_base),iov[i].iov_len);
+          return;
+        }
+        //writeAll会修改iov: 拷贝一份,段数少时放在栈上
+        struct iovec local[4];
+        std::vector<struct iovec> heap;
+        struct iovec *all = local;
+        if(cnt+1>4){ heap.resize(cnt+1); all = heap.data(); }
+        int n = 0;
+        if(!_buf.empty()){ all[n].iov_base = &_buf[0]; all[n].iov_len = _buf.size(); n++; }
+        for(int i = 0;i<cnt;i++) all[n++] = iov[i];
+        writeAll(all,n);
+        _buf.clear();
+      }
+      void flush(bool fsync)override{
+        (void)fsync; //终端/管道不需要落盘
+        writeBuffered(nullptr,0);
+      }
+      bool colorLevel() const override { return _color; }
+
+    private:
+      //缓冲区与本次数据一次writev写出
+      void writeBuffered(const char *data,size_t len){
+        struct iovec iov[2];
+        int cnt = 0;
+        if(!_buf.empty()){ iov[cnt].iov_base = &_buf[0]; iov[cnt].iov_len = _buf.size(); cnt++; }
+        if(len){ iov[cnt].iov_base = const_cast<char*>(data); iov[cnt].iov_len = len; cnt++; }
+        if(cnt) writeAll(iov,cnt);
+        _buf.clear();
+      }
+
+      //写完为止: 处理部分写入与EINTR; 非阻塞的标准输出写满时等待可写
+      void writeAll(struct iovec *iov,int cnt){
+        while(cnt>0){
+          ssize_t n = ::writev(_fd,iov,cnt);
+          if(n<0){
+            if(errno==EINTR) continue;
+            if(errno==EAGAIN || errno==EWOULDBLOCK){
+              struct pollfd pfd{_fd,POLLOUT,0};
+              poll(&pfd,1,100);
+              continue;
+            }
+            size_t lost = 0;
+            for(int i = 0;i<cnt;i++) lost += iov[i].iov_len;
+            _metrics.drops.add(lost); //标准输出已关闭等,丢弃
+            return;
+          }
+          while(cnt>0 && (size_t)n>=iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+          }
+          if(cnt>0){
+            iov->iov_base = static_cast<char*>(iov->iov_base)+n;
+            iov->iov_len -= n;
+          }
+        }
       }
+
+    private:
+      int _fd;
+      bool _color;
+      size_t _buffer_size;
+      std::string _buf;
   };
+  /*
+    FileSink
+    multi_process = true: 多进程(如prefork服务)同时写同一个文件
+      ofstream的缓冲写会在任意位置切开记录,多个进程的输出互相穿插
+      改为 O_APPEND + 每次log一次writev,写入期间持有flock排他锁:
+      - 追加写在内核中原子地定位到文件尾,一次writev的数据在文件中连续
+      - writev可能只写入一部分(大批量,信号中断),续写前其他进程可能已追加;
+        flock是建议锁,只有所有写入者(包括单条的小记录)都加锁,续写才不会与其他进程交错
+      每批一次writev加一对加解锁; 同一文件的写入在内核中本来就按inode串行,加锁不降低吞吐上限
+  */
   class FileSink : public LogSink{
     public:
-      FileSink(const std::string& pathname)
-        :_pathname(pathname)
+      FileSink(const std::string& pathname,bool multi_process = false)
+        :_pathname(pathname),_fd(-1)
       {
         //保证目录存在
         util::FileUtil::createDirectory(util::FileUtil::getPath(_pathname));
+        if(multi_process){
+          _fd = open(_pathname.c_str(),O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+          assert(_fd>=0);
+          return;
+        }
         //取得文件句柄 : 二进制写+追加
         _ofs.open(_pathname,std::ios::binary|std::ios::app);
         assert(_ofs.is_open());
       }
+      ~FileSink(){
+        if(_fd>=0) close(_fd);
+      }
       void log(const char *data,size_t len)override{
+        if(_fd>=0){
+          appendAtomic(data,len);
+          return;
+        }
         _ofs.write(data,len);
         if(!_ofs.good()){
           std::cout<<"FileSinK:日志文件输出失败!"<<"\n";
@@ -48,47 +279,205 @@ namespace log{
         }
       }
 
+      void logv(const struct iovec *iov,int cnt)override{
+        if(_fd>=0){
+          appendAtomic(iov,cnt);
+          return;
+        }
+        for(int i = 0;i<cnt;i++) _ofs.write(static_cast<const char*>(iov[i].iov_base),iov[i].iov_len);
+        if(!_ofs.good()){
+          std::cout<<"FileSinK:日志文件输出失败!"<<"\n";
+          abort();
+        }
+      }
+
+      void flush(bool fsync)override{
+        if(_fd>=0){ //无用户态缓冲
+          if(fsync) ::fsync(_fd);
+          return;
+        }
+        _ofs.flush();
+        if(fsync) util::FileUtil::syncFile(_pathname);
+      }
+
+      private:
+      void appendAtomic(const char *data,size_t len){
+        struct iovec iov{const_cast<char*>(data),len};
+        appendAtomic(&iov,1);
+      }
+      //多段一次writev; 部分写入时在锁内续写
+      void appendAtomic(const struct iovec *iov,int cnt){
+        //部分写入时要修改iov,拷贝一份; 段数少时放在栈上
+        struct iovec local[4];
+        std::vector<struct iovec> heap;
+        struct iovec *rest = local;
+        if(cnt>4){ heap.assign(iov,iov+cnt); rest = heap.data(); }
+        else std::copy(iov,iov+cnt,local);
+        while(flock(_fd,LOCK_EX)<0 && errno==EINTR){}
+        while(cnt>0){
+          ssize_t n = ::writev(_fd,rest,cnt);
+          if(n<0){
+            if(errno==EINTR) continue;
+            std::cout<<"FileSinK:日志文件输出失败!"<<"\n";
+            abort();
+          }
+          while(cnt>0 && (size_t)n>=rest->iov_len){
+            n -= rest->iov_len;
+            rest++;
+            cnt--;
+          }
+          if(cnt>0){
+            rest->iov_base = static_cast<char*>(rest->iov_base)+n;
+            rest->iov_len -= n;
+          }
+        }
+        flock(_fd,LOCK_UN);
+      }
+
       private:
       std::string _pathname; //文件路径
       std::ofstream _ofs;//文件句柄
+      int _fd;           //多进程追加模式下的文件描述符
   };
 
+  /*
+    按大小滚动
+    滚动时的开销(关闭旧文件的flush,拼接文件名,localtime_r,open)原本都在写日志的线程上,每次滚动出现一次延迟尖刺
+    优化: 后台线程提前创建好下一个文件并fallocate预留空间,滚动时只交换文件句柄; 旧文件也交给后台关闭
+    注: 文件名中的时间是预创建的时间,而不是开始写入的时间
+
+    policy: 可选的保留策略(文件数/总大小/保留时间),由RetentionManager在后台清理旧文件
+  */
   class RollBySizeSink:public LogSink{
     public:
-      RollBySizeSink(std::string basename,size_t max_fsize)
-      :_basename(basename),_max_fsize(max_fsize),_name_count(0)
+      RollBySizeSink(std::string basename,size_t max_fsize,const RetentionPolicy& policy = RetentionPolicy())
+      :_basename(basename),_max_fsize(max_fsize),_cur_fsize(0),_name_count(0),_stop(false)
       {
         //保存目录存在
         util::FileUtil::createDirectory(util::FileUtil::getPath(_basename));
-        //构建文件名
-        std::string filename = createNewFileName();
-        //获取文件句柄
-        _ofs.open(filename,std::ios::binary|std::ios::app);
-        if(!_ofs.is_open()){
-          std::cout<<"RollBySizeSink: 打开文件失败!"<<"\n";
-          abort();
+        //保留策略 -- 须在创建本次的第一个文件前接管已有文件
+        if(policy.enabled()){
+          _retention = std::make_shared<RetentionManager>(_basename,policy);
+        }
+        //第一个文件同步创建
+        _ofs = openSegment();
+        _cur_name = _last_name;
+        if(_retention) _retention->segmentOpened(_cur_name,0);
+        //后台线程准备下一个文件
+        _thread = std::thread(&RollBySizeSink::prepareEntry,this);
+      }
+
+      ~RollBySizeSink(){
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _stop = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+        //预创建但未使用的文件删除,不留空文件
+        if(_next_ofs){
+          _next_ofs->close();
+          unlink(_next_name.c_str());
         }
       }
+
       void log(const char *data ,size_t len) override{
         if(_cur_fsize>=_max_fsize){
+          roll();
+          if(_retention) _retention->segmentOpened(_cur_name,_cur_fsize);
           //每次新建文件时需要清零,否则在1s内会一直创建文件,且创建的文件是相同的,即1s内使用的依旧是旧文件.
           _cur_fsize = 0;
-          //关闭旧的文件句柄
-          _ofs.close();
-          //构建文件名
-          std::string filename = createNewFileName();
-          //获取文件句柄
-          _ofs.open(filename,std::ios::binary|std::ios::app);
-          if(!_ofs.is_open()){
-            std::cout<<"RollBySizeSink::log: 打开文件失败!"<<"\n";
-            abort();
-          }
         }
-        _ofs.write(data,len);
+        _ofs->write(data,len);
         _cur_fsize+=len;
       }
 
+      //各段属于同一条记录: 只在记录前检查一次滚动
+      void logv(const struct iovec *iov,int cnt) override{
+        if(cnt==0) return;
+        log(static_cast<const char*>(iov[0].iov_base),iov[0].iov_len);
+        for(int i = 1;i<cnt;i++){
+          _ofs->write(static_cast<const char*>(iov[i].iov_base),iov[i].iov_len);
+          _cur_fsize += iov[i].iov_len;
+        }
+      }
+
+      //旧文件由后台关闭: 等它们关闭完成,保证滚动前写入的数据也已交给内核
+      void flush(bool fsync)override{
+        _ofs->flush();
+        std::vector<std::string> unsynced;
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _cond.wait(lock,[&](){ return _closing==0; });
+          if(fsync) unsynced.swap(_unsynced);
+        }
+        if(!fsync) return;
+        for(auto& name:unsynced) util::FileUtil::syncFile(name);
+        util::FileUtil::syncFile(_cur_name);
+      }
+
     private:
+      //交换到预创建的文件 -- 正常情况下后台早已准备好,不会等待
+      void roll(){
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock,[&](){ return _next_ofs!=nullptr; });
+        _closing++;
+        _unsynced.push_back(_cur_name);
+        if(_unsynced.size()>64) _unsynced.erase(_unsynced.begin()); //很久以前滚动的文件早已被内核回写
+        _retired.push_back(std::move(_ofs));
+        _ofs = std::move(_next_ofs);
+        _cur_name = _next_name;
+        _cond.notify_all();
+      }
+
+      //后台线程: 关闭旧文件,准备下一个文件
+      void prepareEntry(){
+        while(true){
+          std::vector<std::unique_ptr<std::ofstream>> retired;
+          bool need_next = false;
+          {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock,[&](){ return _stop || _next_ofs==nullptr || !_retired.empty(); });
+            retired.swap(_retired);
+            need_next = !_stop && _next_ofs==nullptr;
+            if(_stop && retired.empty()) break;
+          }
+          for(auto& ofs:retired) ofs->close(); //flush+close在后台完成
+          if(!retired.empty()){
+            std::unique_lock<std::mutex> lock(_mutex);
+            _closing -= retired.size();
+            _cond.notify_all();
+          }
+          if(need_next){
+            std::unique_ptr<std::ofstream> next = openSegment();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _next_ofs = std::move(next);
+            _next_name = _last_name;
+            _cond.notify_all();
+          }
+        }
+      }
+
+      //创建新文件: 预留空间后打开
+      std::unique_ptr<std::ofstream> openSegment(){
+        //构建文件名
+        std::string filename = createNewFileName();
+        //fallocate预留磁盘块,写入时不再逐块分配; KEEP_SIZE保持文件长度为0,追加写仍从头开始
+        int fd = open(filename.c_str(),O_WRONLY|O_CREAT|O_CLOEXEC,0644);
+        if(fd>=0){
+          fallocate(fd,FALLOC_FL_KEEP_SIZE,0,_max_fsize); //不支持的文件系统上失败也不影响使用
+          close(fd);
+        }
+        //获取文件句柄
+        std::unique_ptr<std::ofstream> ofs(new std::ofstream(filename,std::ios::binary|std::ios::app));
+        if(!ofs->is_open()){
+          std::cout<<"RollBySizeSink: 打开文件失败!"<<"\n";
+          abort();
+        }
+        _last_name = filename;
+        return ofs;
+      }
+
       std::string createNewFileName(){
         //根据当前时间构建 // ./logs/base-20230102030507.log
         time_t timestamp = util::DateUtil::getCurTime();
@@ -112,10 +501,24 @@ namespace log{
 
     private:
       std::string _basename; //用户自定义文件名前缀
-      std::ofstream _ofs;      //文件句柄
+      std::unique_ptr<std::ofstream> _ofs;      //文件句柄
       size_t _max_fsize;      //用户定义最大存储大小
       size_t _cur_fsize;      //当前已写入大小
       size_t _name_count;     //命名编号:防止时间过短时命名相同
+
+      //后台预创建
+      std::mutex _mutex;
+      std::condition_variable _cond;
+      bool _stop;
+      std::unique_ptr<std::ofstream> _next_ofs;               //预创建好的下一个文件
+      std::string _next_name;
+      std::string _last_name;                                  //最近一次创建的文件名,只在构造与后台线程中访问
+      std::string _cur_name;                                   //正在写入的文件名
+      std::vector<std::unique_ptr<std::ofstream>> _retired;   //待后台关闭的旧文件
+      size_t _closing = 0;                                     //已滚动但后台尚未关闭完的文件数
+      std::vector<std::string> _unsynced;                      //上次落盘后滚动出去的文件名
+      RetentionManager::s_ptr _retention;                      //保留策略,未设置时为空
+      std::thread _thread;
   };
 
   //类简单工厂 -- 根据参数返回对应的产品
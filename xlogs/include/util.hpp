@@ -4,20 +4,66 @@
 #include<iostream>
 #include<fstream>
 #include<chrono>
+#include<cstdint>
+
+#include<string>
+#include<cstring>
+#include<cstdio>
+
+#include<ctime>
 
 #include<unistd.h>
+#include<fcntl.h>
+#include<pthread.h>
 #include<sys/types.h>
 #include<sys/stat.h>
+#include<sys/syscall.h>
 
 
 namespace log{
   namespace util{
 
+    //取时间使用的时钟:
+    //  CLOCK_REALTIME         默认,vDSO实现不陷入内核,纳秒精度,开销与原来的system_clock::now()相同
+    //  CLOCK_REALTIME_COARSE  定义XLOG_COARSE_CLOCK启用,更便宜,但精度只有一个时钟节拍(1~4ms),无法区分同一节拍内的先后
+#ifdef XLOG_COARSE_CLOCK
+    #define XLOG_CLOCK_ID CLOCK_REALTIME_COARSE
+#else
+    #define XLOG_CLOCK_ID CLOCK_REALTIME
+#endif
+
     class DateUtil{
       public:
+        //纳秒级日历时间(自1970年起)
+        static uint64_t getCurTimeNs(){
+          struct timespec ts;
+          clock_gettime(XLOG_CLOCK_ID,&ts);
+          return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+        }
+
+        //粗粒度秒数(CLOCK_REALTIME_COARSE,精度一个时钟节拍) -- 只用于与截止时间比较这类不需要精度的热路径
+        static time_t getCoarseTime(){
+          struct timespec ts;
+          clock_gettime(CLOCK_REALTIME_COARSE,&ts);
+          return ts.tv_sec;
+        }
+
         static time_t getCurTime(){
           return std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
         }
+
+        //单调时钟纳秒数 -- 只用于计算耗时,不表示日历时间
+        static uint64_t getSteadyNs(){
+          return std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        //粗粒度单调时钟纳秒数(CLOCK_MONOTONIC_COARSE,精度一个时钟节拍) -- 每条日志都要取,只需毫秒级窗口的热路径
+        static uint64_t getCoarseSteadyNs(){
+          struct timespec ts;
+          clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+          return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+        }
     }; //CLASS_DataUtil_END
 
     class FileUtil{
@@ -35,6 +81,15 @@ namespace log{
           return pos == std::string::npos? ".":pathname.substr(0,pos+1);
         }
 
+        //将文件已写入内核的数据落盘; ofstream拿不到描述符,按路径重新打开后fsync(作用于同一inode)
+        static bool syncFile(const std::string& pathname){
+          int fd = open(pathname.c_str(),O_RDONLY|O_CLOEXEC);
+          if(fd<0) return false;
+          int ret = fsync(fd);
+          close(fd);
+          return ret==0;
+        }
+
         static void createDirectory(const std::string& pathname){
           //./abc/de/fgh  
           //./
@@ -63,6 +118,43 @@ namespace log{
 
     }; //CLASS_FileUtil__END
 
+    //线程信息: 每个线程首次打日志时采集一次并预先格式化,之后每条日志只需拷贝
+    struct ThreadInfo{
+      char tid[24];       //内核线程id(与top/ps/perf一致),已转成字符串
+      size_t tid_len;
+      std::string name;   //线程名,默认取系统线程名,可由setThreadName设置
+    };
+
+    class ThreadUtil{
+      public:
+        //当前线程的缓存信息 -- 引用在线程存活期间有效
+        static const ThreadInfo& current(){ return self(); }
+
+        //设置当前线程名: 日志中使用完整名称,系统线程名受内核限制截断为15字节
+        static void setThreadName(const std::string& name){
+          self().name = name;
+          pthread_setname_np(pthread_self(),name.substr(0,15).c_str());
+        }
+
+      private:
+        static ThreadInfo& self(){
+          thread_local ThreadInfo info = capture();
+          return info;
+        }
+
+        static ThreadInfo capture(){
+          ThreadInfo info;
+          long tid = syscall(SYS_gettid);
+          int n = snprintf(info.tid,sizeof(info.tid),"%ld",tid);
+          info.tid_len = n>0? n:0;
+          char name[16] = {0};
+          if(pthread_getname_np(pthread_self(),name,sizeof(name))==0){
+            info.name = name;
+          }
+          return info;
+        }
+    }; //CLASS_ThreadUtil__END
+
   } //namespace_util_END
 } //namespace_Log__END
 
@@ -3,6 +3,7 @@
 
 
 #include"logger.hpp"
+#include"net_sink.hpp"
 
 namespace log{
 
@@ -26,6 +27,8 @@ namespace log{
   #define warn(fmt, ... ) warn( __FILE__,__LINE__,fmt, ##__VA_ARGS__)
   #define error(fmt, ...) error(__FILE__,__LINE__,fmt, ##__VA_ARGS__)
   #define fatal(fmt, ...) fatal(__FILE__,__LINE__,fmt, ##__VA_ARGS__)
+  //零拷贝消息体: payload(等级,数据,长度[,释放回调])
+  #define payload(level, data, len, ...) payload(__FILE__,__LINE__,level,data,len, ##__VA_ARGS__)
   
 
   //提供使用默认日志器进行标准输出打印的全局宏函数
@@ -245,6 +245,117 @@ void Test_Global(){
 
 }
 
+void Test_Metrics(){
+  std::unique_ptr<log::LoggerBuilder> builder(new log::GlobalLoggerBuilder());
+  builder->buildLoggerName("metrics_logger");
+  builder->buildLoggerType(log::LoggerType::LOGGER_ASYNC);
+  builder->buildSink<log::FileSink>("logsByfile/metrics.log");
+  builder->build();
+  auto logger = log::getLogger("metrics_logger");
+  for(size_t i = 0;i<100000;i++){
+    logger->info(__FILE__, __LINE__, "%s-%d", "打开文件失败", i);
+  }
+
+  for(auto& st:log::LoggerManager::getInstance().snapshotMetrics()){
+    std::cout<<st.name<<(st.async? "(async)":"(sync)")<<": msgs="<<st.msgs_in<<" bytes="<<st.bytes_in
+             <<" blocks="<<st.looper.producer_blocks<<" block_ns="<<st.looper.block_ns
+             <<" swaps="<<st.looper.swaps<<" high_water="<<st.looper.high_water<<"\n";
+    for(auto& sk:st.sinks){
+      std::cout<<"\t"<<sk.type<<": writes="<<sk.writes<<" bytes="<<sk.bytes
+               <<" write_ns="<<sk.write_ns<<" max_write_ns="<<sk.max_write_ns<<" drops="<<sk.drops<<"\n";
+    }
+  }
+}
+
+//高优先级通道 + 回溯环: 回溯的上下文必须先于触发它的错误输出
+void Test_PriorityBacktrace(){
+  const char* path = "logsByfile/priority_backtrace.log";
+  remove(path);
+  {
+    std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+    builder->buildLoggerName("priority_backtrace");
+    builder->buildLoggerType(log::LoggerType::LOGGER_ASYNC);
+    builder->buildLoggerLevel(log::LogLevel::Value::INFO);
+    builder->buildFormatter("[%p] %m%n");
+    builder->buildPriorityLane(log::LogLevel::Value::ERROR);
+    builder->buildBacktrace(16);
+    builder->buildSink<log::FileSink>(path);
+    auto logger = builder->build();
+    for(int i = 0;i<3;i++){
+      logger->debug("ctx %d", i);
+    }
+    logger->error("boom");
+    logger->flush().wait();
+  }
+  std::ifstream ifs(path);
+  std::string line;
+  std::vector<std::string> lines;
+  while(std::getline(ifs,line)) lines.push_back(line);
+  assert(lines.size()==4);
+  assert(lines[0]=="[DEBUG] ctx 0" && lines[1]=="[DEBUG] ctx 1" && lines[2]=="[DEBUG] ctx 2");
+  assert(lines[3]=="[ERROR] boom");
+  std::cout<<"回溯上下文先于错误输出: OK\n";
+}
+
+//回溯环中的%m: 按写入时的errno输出,而不是回放时的errno
+void Test_BacktraceErrno(){
+  const char* path = "logsByfile/backtrace_errno.log";
+  remove(path);
+  {
+    std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+    builder->buildLoggerName("backtrace_errno");
+    builder->buildLoggerLevel(log::LogLevel::Value::INFO);
+    builder->buildFormatter("[%p] %m%n");
+    builder->buildBacktrace(16);
+    builder->buildSink<log::FileSink>(path);
+    auto logger = builder->build();
+    errno = ENOENT;
+    logger->debug("open %s: %m", "/nonexistent");
+    errno = EACCES;
+    logger->debug("[%-30m]");
+    errno = 0;
+    logger->error("boom");
+  }
+  std::ifstream ifs(path);
+  std::string line;
+  std::vector<std::string> lines;
+  while(std::getline(ifs,line)) lines.push_back(line);
+  char padded[64];
+  snprintf(padded,sizeof(padded),"[DEBUG] [%-30s]",strerror(EACCES));
+  assert(lines.size()==3);
+  assert(lines[0]==std::string("[DEBUG] open /nonexistent: ")+strerror(ENOENT));
+  assert(lines[1]==padded);
+  assert(lines[2]=="[ERROR] boom");
+  std::cout<<"回溯环%m按写入时的errno输出: OK\n";
+}
+
+//大于缓冲区容量的payload: 安全模式下不能一直阻塞,等缓冲区取空后扩容写入
+void Test_LargePayload(){
+  const char* path = "logsByfile/large_payload.log";
+  remove(path);
+  const size_t len = 2*DEFAULT_BUFFER_SIZE;
+  std::string body(len,'x');
+  {
+    std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+    builder->buildLoggerName("large_payload");
+    builder->buildLoggerType(log::LoggerType::LOGGER_ASYNC);
+    builder->buildFormatter("%m%n");
+    builder->buildSink<log::FileSink>(path);
+    auto logger = builder->build();
+    logger->info("before");
+    logger->payload(log::LogLevel::Value::INFO, body.data(), body.size());
+    logger->info("after");
+    logger->flush().wait();
+  }
+  std::ifstream ifs(path);
+  std::string line;
+  std::vector<std::string> lines;
+  while(std::getline(ifs,line)) lines.push_back(line);
+  assert(lines.size()==3);
+  assert(lines[0]=="before" && lines[1]==body && lines[2]=="after");
+  std::cout<<"超过缓冲区容量的payload: OK\n";
+}
+
 int main()
 {
   //Test_Util();
@@ -255,6 +366,10 @@ int main()
   //Test_Builder();
   //Test_Buffer();
   //Test_Async();
+  //Test_Metrics();
+  //Test_PriorityBacktrace();
+  //Test_LargePayload();
+  //Test_BacktraceErrno();
 
   std::unique_ptr<log::LoggerBuilder> builder (new log::GlobalLoggerBuilder());
   builder->buildLoggerName("global_logger");
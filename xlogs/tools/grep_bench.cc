@@ -0,0 +1,94 @@
+#include"xlog_grep.hpp"
+#include"../include/format.hpp"
+
+#include<iostream>
+#include<fstream>
+#include<chrono>
+#include<cstdlib>
+
+/*
+  xlog-grep 基准测试
+  1. 使用Formatter按默认格式生成若干日志段(等级按 DEBUG:INFO:WARN:ERROR:FATAL = 40:40:15:4:1 分布)
+  2. 分别以 单线程memmem / 单线程SIMD / 多线程SIMD 扫描全部段,统计吞吐
+
+  用法: grep_bench [段数=8] [每段MB=64]
+*/
+
+static std::vector<std::string> generate(size_t seg_count,size_t seg_mb){
+  log::util::FileUtil::createDirectory("grep_segments/");
+  log::Formatter fmt;
+  const char* files[] = {"server.cc","conn.cc","db.cc","cache.cc"};
+  const char* loggers[] = {"root","net","storage"};
+  std::vector<std::string> paths;
+  size_t seq = 0;
+  for(size_t s = 0;s<seg_count;s++){
+    std::string path = "grep_segments/seg-"+std::to_string(s)+".log";
+    paths.push_back(path);
+    std::ofstream ofs(path,std::ios::binary|std::ios::trunc);
+    size_t written = 0;
+    while(written<seg_mb*1024*1024){
+      size_t r = seq%100;
+      log::LogLevel::Value level = r<40? log::LogLevel::Value::DEBUG:
+                                   r<80? log::LogLevel::Value::INFO:
+                                   r<95? log::LogLevel::Value::WARN:
+                                   r<99? log::LogLevel::Value::ERROR:log::LogLevel::Value::FATAL;
+      log::LogMsg msg(level,files[seq%4],100+seq%50,loggers[seq%3],
+                      "request id="+std::to_string(seq)+" handled, upstream latency within budget");
+      std::string line = fmt.format(msg);
+      ofs.write(line.data(),line.size());
+      written += line.size();
+      seq++;
+    }
+  }
+  return paths;
+}
+
+static void run(const char* name,const std::vector<std::string>& paths,log::grep::Query q){
+  size_t bytes = 0;
+  size_t matched = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(auto& path:paths){
+    log::grep::MappedFile file(path);
+    bytes += file.size();
+    matched += log::grep::grepFile(file,q,std::cout);
+  }
+  std::chrono::duration<double> cost = std::chrono::steady_clock::now()-start;
+  std::cout<<"\t"<<name<<": 匹配"<<matched<<"行, 耗时:"<<cost.count()<<"s, "
+           <<"吞吐:"<<bytes/cost.count()/(1024*1024*1024)<<"GB/s\n";
+}
+
+int main(int argc,char* argv[]){
+  size_t seg_count = argc>1? std::strtoul(argv[1],nullptr,10):8;
+  size_t seg_mb = argc>2? std::strtoul(argv[2],nullptr,10):64;
+  std::cout<<"生成日志段: "<<seg_count<<"个 x "<<seg_mb<<"MB\n";
+  std::vector<std::string> paths = generate(seg_count,seg_mb);
+
+  //先完整读一遍,让页缓存热起来,只比较扫描本身
+  log::grep::Query warm;
+  warm.count_only = true;
+  warm.setLevel("FATAL");
+  for(auto& path:paths){
+    log::grep::MappedFile file(path);
+    log::grep::grepFile(file,warm,std::cout);
+  }
+
+  const char* cases[] = {"-l ERROR","-c storage -l WARN+","-f db.cc:120","id=424242"};
+  for(auto& c:cases){
+    log::grep::Query q;
+    q.count_only = true;
+    std::string title = c;
+    if(title=="-l ERROR") q.setLevel("ERROR");
+    else if(title=="-c storage -l WARN+"){ q.setLogger("storage"); q.setLevel("WARN+"); }
+    else if(title=="-f db.cc:120") q.setFileLine("db.cc:120");
+    else q.pattern = title;
+
+    std::cout<<"--------------"<<title<<"--------------\n";
+    q.threads = 1; q.simd = false;
+    run("单线程memmem",paths,q);
+    q.simd = true;
+    run("单线程SIMD  ",paths,q);
+    q.threads = 0;
+    run("多线程SIMD  ",paths,q);
+  }
+  return 0;
+}
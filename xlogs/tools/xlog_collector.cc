@@ -0,0 +1,193 @@
+#include"../include/xlog.h"
+
+#include<iostream>
+#include<iomanip>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<thread>
+#include<atomic>
+#include<cstdlib>
+#include<cstring>
+
+#include<unistd.h>
+#include<poll.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<sys/socket.h>
+
+/*
+  xlog-collector -- 本地日志收集端,用于测试NetSink
+
+  收集模式: 监听端口,接收TCP连接或UDP报文,按行统计,可选写入文件
+  压测模式(-b N): 同一进程内再起一个异步日志器,经NetSink把N条日志发往本收集端,
+                  全部收到后输出端到端吞吐与NetSink的丢弃量
+
+  用法: xlog-collector [-p 端口=9000] [-u] [-o 输出文件] [-b 条数] [-s 单条字节数=100]
+*/
+
+struct Options{
+  uint16_t port = 9000;
+  bool udp = false;
+  std::string out;
+  size_t bench = 0;
+  size_t msg_size = 100;
+};
+
+static void usage(){
+  std::cout<<"用法: xlog-collector [-p 端口=9000] [-u] [-o 输出文件] [-b 条数] [-s 单条字节数=100]\n"
+           <<"  -p  监听端口\n"
+           <<"  -u  使用UDP(默认TCP)\n"
+           <<"  -o  收到的日志写入文件\n"
+           <<"  -b  压测模式: 进程内发送指定条数的日志,收齐(或2s内无新数据)后退出\n"
+           <<"  -s  压测模式下单条日志的消息长度\n";
+}
+
+class Collector{
+  public:
+    Collector(const Options& opt):_opt(opt),_lines(0),_bytes(0){
+      _listen = socket(AF_INET,opt.udp? SOCK_DGRAM:SOCK_STREAM,0);
+      int one = 1;
+      setsockopt(_listen,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+      if(opt.udp){
+        int rcvbuf = 8*1024*1024;
+        setsockopt(_listen,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+      }
+      struct sockaddr_in addr;
+      memset(&addr,0,sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(opt.port);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if(bind(_listen,(struct sockaddr*)&addr,sizeof(addr))<0){
+        std::cout<<"bind失败: "<<strerror(errno)<<"\n";
+        exit(1);
+      }
+      if(!opt.udp) listen(_listen,16);
+      if(!opt.out.empty()) _ofs.open(opt.out,std::ios::binary|std::ios::app);
+    }
+
+    ~Collector(){
+      for(auto& p:_fds) close(p.fd);
+    }
+
+    //expect>0时收到expect行后返回; idle_ms内没有数据也返回(UDP可能丢包)
+    void run(size_t expect,int idle_ms){
+      _fds.push_back(pollfd{_listen,POLLIN,0});
+      std::vector<char> buf(1<<20);
+      uint64_t last_report = log::util::DateUtil::getSteadyNs();
+      uint64_t last_lines = 0,last_bytes = 0;
+      while(expect==0 || _lines<expect){
+        int n = poll(_fds.data(),_fds.size(),idle_ms>0? idle_ms:1000);
+        if(n==0 && idle_ms>0) break;
+        for(size_t i = 0;i<_fds.size() && n>0;i++){
+          if(_fds[i].revents==0) continue;
+          n--;
+          if(!_opt.udp && _fds[i].fd==_listen){
+            int conn = accept(_listen,nullptr,nullptr);
+            if(conn>=0) _fds.push_back(pollfd{conn,POLLIN,0});
+            continue;
+          }
+          ssize_t r = recv(_fds[i].fd,buf.data(),buf.size(),0);
+          if(r<=0 && !_opt.udp){
+            close(_fds[i].fd);
+            _fds.erase(_fds.begin()+i);
+            i--;
+            continue;
+          }
+          if(r>0) consume(buf.data(),r);
+        }
+        uint64_t now = log::util::DateUtil::getSteadyNs();
+        if(expect==0 && now-last_report>=1000000000ull){
+          double sec = (now-last_report)/1e9;
+          std::cout<<std::fixed<<std::setprecision(0)<<(_lines-last_lines)/sec<<" lines/s  "
+                   <<std::setprecision(2)<<(_bytes-last_bytes)/sec/1024/1024<<" MB/s  total "<<_lines<<" lines\n";
+          last_report = now;
+          last_lines = _lines;
+          last_bytes = _bytes;
+        }
+      }
+    }
+
+    size_t lines() const { return _lines; }
+    size_t bytes() const { return _bytes; }
+
+  private:
+    void consume(const char* data,size_t len){
+      _bytes += len;
+      for(const char* p = data;(p = static_cast<const char*>(memchr(p,'\n',data+len-p)))!=nullptr;p++) _lines++;
+      if(_ofs.is_open()) _ofs.write(data,len);
+    }
+
+  private:
+    Options _opt;
+    int _listen;
+    std::vector<pollfd> _fds;
+    std::ofstream _ofs;
+    size_t _lines;
+    size_t _bytes;
+};
+
+//压测: 异步日志器 + NetSink 发往本机收集端
+static void runBench(const Options& opt,Collector& collector){
+  std::atomic<bool> done(false);
+  log::LoggerStats stats;
+  uint64_t produce_ns = 0;
+  std::thread producer([&](){
+    std::unique_ptr<log::LoggerBuilder> builder(new log::LocalLoggerBuilder());
+    builder->buildLoggerName("net_bench");
+    builder->buildLoggerType(log::LoggerType::LOGGER_ASYNC);
+    builder->buildFormatter("%m%n");
+    builder->buildSink<log::NetSink>("127.0.0.1",opt.port,opt.udp? log::NetProto::UDP:log::NetProto::TCP);
+    log::Logger::s_ptr logger = builder->build();
+    std::string msg(opt.msg_size,'x');
+    uint64_t start = log::util::DateUtil::getSteadyNs();
+    for(size_t i = 0;i<opt.bench;i++) logger->info("%s",msg.c_str());
+    produce_ns = log::util::DateUtil::getSteadyNs()-start;
+    while(!done.load()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stats = logger->stats();
+  });
+
+  //TCP同样设置空闲超时: NetSink积压区溢出时会丢弃记录,UDP会丢包,收不满时不能一直等待
+  const int idle_ms = 2000;
+  uint64_t start = log::util::DateUtil::getSteadyNs();
+  collector.run(opt.bench,idle_ms);
+  uint64_t cost = log::util::DateUtil::getSteadyNs()-start;
+  done = true;
+  producer.join();
+
+  bool complete = collector.lines()>=opt.bench;
+  if(!complete) cost = cost>idle_ms*1000000ull? cost-idle_ms*1000000ull:cost; //去掉最后的空闲等待
+  double sec = cost/1e9;
+  std::cout<<"发送 "<<opt.bench<<" 条, 收到 "<<collector.lines()<<" 条, "<<collector.bytes()<<" 字节\n";
+  if(!complete){
+    std::cout<<"缺少 "<<opt.bench-collector.lines()<<" 条: "<<idle_ms<<"ms 内没有新数据,结束等待(见下方落地的drops)\n";
+  }
+  std::cout<<std::fixed<<std::setprecision(3)<<"生产耗时 "<<produce_ns/1e9<<" s, 端到端耗时 "<<sec<<" s\n"
+           <<std::setprecision(0)<<"端到端吞吐 "<<collector.lines()/sec<<" lines/s, "
+           <<std::setprecision(2)<<collector.bytes()/sec/1024/1024<<" MB/s\n";
+  for(auto& s:stats.sinks){
+    std::cout<<s.type<<": writes "<<s.writes<<", bytes "<<s.bytes<<", drops "<<s.drops<<" 字节\n";
+  }
+}
+
+int main(int argc,char* argv[]){
+  Options opt;
+  int c;
+  while((c = getopt(argc,argv,"p:uo:b:s:h"))!=-1){
+    switch(c){
+      case 'p': opt.port = (uint16_t)atoi(optarg); break;
+      case 'u': opt.udp = true; break;
+      case 'o': opt.out = optarg; break;
+      case 'b': opt.bench = strtoul(optarg,nullptr,10); break;
+      case 's': opt.msg_size = strtoul(optarg,nullptr,10); break;
+      default: usage(); return c=='h'? 0:1;
+    }
+  }
+  Collector collector(opt);
+  if(opt.bench) runBench(opt,collector);
+  else{
+    std::cout<<"xlog-collector 监听 127.0.0.1:"<<opt.port<<(opt.udp? " (UDP)\n":" (TCP)\n");
+    collector.run(0,0);
+  }
+  return 0;
+}
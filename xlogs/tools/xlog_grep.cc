@@ -0,0 +1,74 @@
+#include"xlog_grep.hpp"
+
+#include<iostream>
+#include<string>
+#include<cstdlib>
+
+//xlog-grep [-l LEVEL[+]] [-c LOGGER] [-f FILE[:LINE]] [-e PATTERN] [-j N] [-C] [-b] [--no-simd] [PATTERN] FILE...
+
+static void usage(){
+  std::cout<<"用法: xlog-grep [选项] [PATTERN] FILE...\n"
+           <<"  -e PATTERN  子串匹配; 与字段过滤条件同时使用时必须用-e给出\n"
+           <<"  -l LEVEL    按等级过滤, 如 ERROR; WARN+ 表示WARN及以上\n"
+           <<"  -c LOGGER   按日志器名称过滤\n"
+           <<"  -f FILE[:LINE] 按源文件(与行号)过滤\n"
+           <<"  -j N        扫描线程数,默认全部核心\n"
+           <<"  -C          只输出匹配行数\n"
+           <<"  -b          输出行首字节偏移\n"
+           <<"  --no-simd   使用memmem代替SIMD匹配\n";
+}
+
+int main(int argc,char* argv[]){
+  log::grep::Query q;
+  std::vector<std::string> args;
+  bool has_filter = false;
+  bool has_pattern = false;
+
+  for(int i = 1;i<argc;i++){
+    std::string arg = argv[i];
+    auto next = [&]()->std::string{
+      if(i+1>=argc){ usage(); exit(2); }
+      return argv[++i];
+    };
+    if(arg=="-l"){
+      if(!q.setLevel(next())){
+        std::cout<<"xlog-grep: 未知的日志等级: "<<argv[i]<<"\n";
+        return 2;
+      }
+      has_filter = true;
+    }
+    else if(arg=="-e"){ q.pattern = next(); has_pattern = true; }
+    else if(arg=="-c"){ q.setLogger(next()); has_filter = true; }
+    else if(arg=="-f"){ q.setFileLine(next()); has_filter = true; }
+    else if(arg=="-j"){ q.threads = std::strtoul(next().c_str(),nullptr,10); }
+    else if(arg=="-C"){ q.count_only = true; }
+    else if(arg=="-b"){ q.byte_offset = true; }
+    else if(arg=="--no-simd"){ q.simd = false; }
+    else if(arg=="-h"||arg=="--help"){ usage(); return 0; }
+    else args.push_back(arg);
+  }
+
+  //与grep一致:首个位置参数为PATTERN;已给出-e或字段过滤条件时,位置参数全部视为文件
+  if(!has_pattern && !has_filter && !args.empty()){
+    q.pattern = args[0];
+    args.erase(args.begin());
+  }
+  if(args.empty()){
+    usage();
+    return 2;
+  }
+
+  size_t total = 0;
+  for(auto& path:args){
+    log::grep::MappedFile file(path);
+    if(!file.ok()){
+      std::cout<<"xlog-grep: 无法打开文件: "<<path<<"\n";
+      continue;
+    }
+    size_t matched = log::grep::grepFile(file,q,std::cout);
+    total += matched;
+    if(q.count_only && args.size()>1) std::cout<<path<<":"<<matched<<"\n";
+  }
+  if(q.count_only && args.size()==1) std::cout<<total<<"\n";
+  return total>0? 0:1; //与grep一致:有匹配返回0
+}
@@ -0,0 +1,270 @@
+#ifndef XLOG_GREP_HPP
+#define XLOG_GREP_HPP
+
+#include<iostream>
+#include<string>
+#include<vector>
+#include<thread>
+#include<cstring>
+
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#if defined(__SSE2__)
+#include<emmintrin.h>
+#endif
+
+#include"../include/level.hpp"
+
+/*
+  xlog-grep: 日志段并行检索工具
+  : 针对Formatter输出的日志段(含RollBySizeSink/RollbyTimeSink滚动出的文件),替代 cat|grep 的单核扫描
+
+  1. mmap映射 -- 不拷贝文件内容,由内核按需调页
+  2. 分块并行 -- 按线程数切块,切点对齐到行首,每个线程独立扫描,结果按块顺序输出
+  3. SIMD子串匹配 -- 一次比较16字节的首尾字符,候选位置再memcmp确认
+
+  过滤条件与默认格式 "[%d{%H:%M:%S}][%t][%p][%c][%f:%l] %m%n" 中的字段对应:
+    level   -> [%p]      例: [ERROR]
+    logger  -> [%c]      例: [root]
+    file    -> [%f:%l]   例: [main.cc:99] 或只给文件名 [main.cc:
+  字段以[]包裹,匹配时带上括号,避免消息主体中的同名单词误命中
+*/
+
+namespace log{
+  namespace grep{
+
+    //子串查找 -- 返回首次出现位置,未找到返回nullptr
+    //思路: 取needle首尾字符各广播到16字节,与haystack的[i,i+16)与[i+n-1,i+n-1+16)并行比较,
+    //      两者都相等的位置才是候选,候选再做完整比较 -- 首尾双重过滤,绝大多数块一次比较即可跳过
+    inline const char* find(const char* hay,size_t hay_len,const char* needle,size_t n){
+      if(n==0) return hay;
+      if(hay_len<n) return nullptr;
+      if(n==1) return static_cast<const char*>(memchr(hay,needle[0],hay_len));
+#if defined(__SSE2__)
+      const __m128i first = _mm_set1_epi8(needle[0]);
+      const __m128i last  = _mm_set1_epi8(needle[n-1]);
+      size_t i = 0;
+      for(;i+n-1+16<=hay_len;i+=16){
+        __m128i blk_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay+i));
+        __m128i blk_last  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay+i+n-1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first,blk_first),
+                                                        _mm_cmpeq_epi8(last,blk_last)));
+        while(mask){
+          unsigned bit = __builtin_ctz(mask);
+          if(memcmp(hay+i+bit+1,needle+1,n-2)==0) return hay+i+bit;
+          mask &= mask-1; //清除最低位
+        }
+      }
+      //尾部不足16字节,交给libc
+      if(i<hay_len){
+        return static_cast<const char*>(memmem(hay+i,hay_len-i,needle,n));
+      }
+      return nullptr;
+#else
+      return static_cast<const char*>(memmem(hay,hay_len,needle,n));
+#endif
+    }
+
+    //检索条件
+    struct Query{
+      std::string pattern;                //子串,空表示不限
+      std::vector<std::string> levels;    //允许的等级token,空表示不限; 任一命中即可
+      std::string logger;                 //日志器token
+      std::string fileline;               //文件[:行号]token
+      bool count_only = false;            //只统计行数
+      bool byte_offset = false;           //输出时带上行首的字节偏移(同grep -b) -- 行号需全量计数,代价高
+      bool simd = true;                   //关闭后使用memmem,便于基准对比
+      size_t threads = 0;                 //0表示使用全部核心
+
+      //解析等级参数: "ERROR" 精确匹配, "WARN+" 表示WARN及以上
+      bool setLevel(const std::string& arg){
+        std::string name = arg;
+        bool and_above = false;
+        if(!name.empty() && name.back()=='+'){
+          and_above = true;
+          name.pop_back();
+        }
+        bool found = false;
+        for(int v = (int)LogLevel::Value::DEBUG;v<=(int)LogLevel::Value::FATAL;v++){
+          const char* str = LogLevel::toString((LogLevel::Value)v);
+          if(name==str) found = true;
+          if(found){
+            levels.push_back(std::string("[")+str+"]");
+            if(!and_above) break;
+          }
+        }
+        return found;
+      }
+      void setLogger(const std::string& name){ logger = "["+name+"]"; }
+      //只给文件名时匹配"[file:",带行号时匹配"[file:line]"
+      void setFileLine(const std::string& fl){
+        fileline = fl.find(':')==std::string::npos? "["+fl+":" : "["+fl+"]";
+      }
+    };
+
+    //一段扫描结果
+    struct ChunkResult{
+      size_t matched = 0;
+      std::string out; //匹配行,保持原始顺序
+    };
+
+    class Scanner{
+      public:
+        Scanner(const Query& q):_q(q){
+          //选择驱动扫描的needle: 越具体越好 -- 子串 > 文件行号 > 日志器 > 单一等级
+          if(!_q.pattern.empty()) _driver = _q.pattern;
+          else if(!_q.fileline.empty()) _driver = _q.fileline;
+          else if(!_q.logger.empty()) _driver = _q.logger;
+          else if(_q.levels.size()==1) _driver = _q.levels[0];
+        }
+
+        //扫描[begin,end),begin必须在行首
+        void scan(const char* begin,const char* end,ChunkResult& res) const {
+          const char* pos = begin;
+          while(pos<end){
+            const char* line_begin;
+            const char* line_end;
+            if(_driver.empty()){ //没有可驱动的needle,逐行检查
+              line_begin = pos;
+              line_end = lineEnd(pos,end);
+            }
+            else{
+              const char* hit = search(pos,end-pos,_driver);
+              if(hit==nullptr) break;
+              line_begin = lineBegin(pos,hit);
+              line_end = lineEnd(hit,end);
+            }
+            if(matchLine(line_begin,line_end)){
+              res.matched++;
+              if(!_q.count_only){
+                if(_q.byte_offset){
+                  res.out += std::to_string(line_begin-_base);
+                  res.out += ':';
+                }
+                res.out.append(line_begin,line_end-line_begin);
+                res.out += '\n';
+              }
+            }
+            pos = line_end+1; //跳过'\n'
+          }
+        }
+
+        void setBase(const char* base){ _base = base; }
+
+      private:
+        const char* search(const char* hay,size_t len,const std::string& needle) const {
+          if(_q.simd) return find(hay,len,needle.data(),needle.size());
+          return static_cast<const char*>(memmem(hay,len,needle.data(),needle.size()));
+        }
+
+        static const char* lineBegin(const char* lower,const char* p){
+          const char* nl = static_cast<const char*>(memrchr(lower,'\n',p-lower));
+          return nl==nullptr? lower:nl+1;
+        }
+        static const char* lineEnd(const char* p,const char* upper){
+          const char* nl = static_cast<const char*>(memchr(p,'\n',upper-p));
+          return nl==nullptr? upper:nl;
+        }
+
+        bool contains(const char* b,const char* e,const std::string& needle) const {
+          return search(b,e-b,needle)!=nullptr;
+        }
+
+        //驱动needle已命中,检查其余条件
+        bool matchLine(const char* b,const char* e) const {
+          if(!_q.pattern.empty() && !contains(b,e,_q.pattern)) return false;
+          if(!_q.fileline.empty() && !contains(b,e,_q.fileline)) return false;
+          if(!_q.logger.empty() && !contains(b,e,_q.logger)) return false;
+          if(!_q.levels.empty()){
+            bool any = false;
+            for(auto& lv:_q.levels){
+              if(contains(b,e,lv)){ any = true; break; }
+            }
+            if(!any) return false;
+          }
+          return true;
+        }
+
+      private:
+        Query _q;
+        std::string _driver; //驱动扫描的needle
+        const char* _base = nullptr; //文件起始地址,用于计算偏移
+    };
+
+    //只读映射一个日志文件
+    class MappedFile{
+      public:
+        MappedFile(const std::string& path){
+          _fd = open(path.c_str(),O_RDONLY);
+          if(_fd<0) return;
+          struct stat st;
+          if(fstat(_fd,&st)<0 || st.st_size==0) return;
+          _size = st.st_size;
+          void* addr = mmap(nullptr,_size,PROT_READ,MAP_PRIVATE,_fd,0);
+          if(addr==MAP_FAILED){ _size = 0; return; }
+          _data = static_cast<const char*>(addr);
+          madvise(addr,_size,MADV_SEQUENTIAL);
+        }
+        ~MappedFile(){
+          if(_data) munmap(const_cast<char*>(_data),_size);
+          if(_fd>=0) close(_fd);
+        }
+        bool ok() const { return _fd>=0; }
+        const char* data() const { return _data; }
+        size_t size() const { return _size; }
+      private:
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+      private:
+        int _fd = -1;
+        const char* _data = nullptr;
+        size_t _size = 0;
+    };
+
+    //并行扫描一个文件,返回命中行数;匹配行按原顺序写到out
+    inline size_t grepFile(const MappedFile& file,const Query& q,std::ostream& out){
+      if(file.size()==0) return 0;
+      size_t nthreads = q.threads? q.threads:std::thread::hardware_concurrency();
+      if(nthreads==0) nthreads = 1;
+      //小文件不值得开线程: 每线程至少1M
+      const size_t min_chunk = 1024*1024;
+      if(file.size()/nthreads<min_chunk) nthreads = file.size()/min_chunk+1;
+
+      //切块并对齐到行首 -- 每块起点是上一个'\n'之后
+      const char* base = file.data();
+      const char* end = base+file.size();
+      std::vector<const char*> cuts;
+      cuts.push_back(base);
+      for(size_t i = 1;i<nthreads;i++){
+        const char* p = base+file.size()/nthreads*i;
+        if(p<=cuts.back()) continue;
+        const char* nl = static_cast<const char*>(memchr(p,'\n',end-p));
+        if(nl==nullptr) break;
+        cuts.push_back(nl+1);
+      }
+      cuts.push_back(end);
+
+      Scanner scanner(q);
+      scanner.setBase(base);
+      std::vector<ChunkResult> results(cuts.size()-1);
+      std::vector<std::thread> threads;
+      for(size_t i = 0;i+1<cuts.size();i++){
+        threads.emplace_back([&,i](){ scanner.scan(cuts[i],cuts[i+1],results[i]); });
+      }
+      for(auto& th:threads) th.join();
+
+      size_t matched = 0;
+      for(auto& r:results){
+        matched += r.matched;
+        if(!q.count_only) out.write(r.out.data(),r.out.size());
+      }
+      return matched;
+    }
+
+  } //namespace_grep_END
+} //namespace_log_END
+
+#endif
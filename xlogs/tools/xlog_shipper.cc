@@ -0,0 +1,104 @@
+#include"../include/xlog.h"
+#include"../include/shm_sink.hpp"
+
+#include<iostream>
+#include<string>
+#include<memory>
+#include<atomic>
+#include<cstdlib>
+#include<csignal>
+
+#include<unistd.h>
+
+/*
+  xlog-shipper -- 共享内存环的消费者守护进程
+  业务进程使用ShmSink把日志写入共享内存,本进程取出后用已有落地方式写文件
+
+  - 每轮取出环中全部已提交记录,攒入Buffer后一次落地
+  - 环为空时逐步退避休眠(最长1ms),不占满CPU
+  - 收到SIGINT/SIGTERM后取完剩余记录再退出
+  - 启动时共享段中残留的记录(如业务进程崩溃前已发布的)会先被写出
+
+  用法: xlog-shipper -o 输出路径 [-n 共享段名=/xlog] [-s 环大小MB=64] [-r 滚动大小MB] [-d] [-u]
+*/
+
+static std::atomic<bool> g_stop(false);
+
+static void onSignal(int){ g_stop = true; }
+
+static void usage(){
+  std::cout<<"用法: xlog-shipper -o 输出路径 [-n 共享段名=/xlog] [-s 环大小MB=64] [-r 滚动大小MB] [-d] [-u]\n"
+           <<"  -o  输出文件; 指定-r时为滚动文件名前缀\n"
+           <<"  -n  共享段名称,与ShmSink一致\n"
+           <<"  -s  共享段不存在时按此大小创建\n"
+           <<"  -r  按大小滚动(RollBySizeSink)\n"
+           <<"  -d  取空后退出(一次性导出)\n"
+           <<"  -u  退出时删除共享段\n";
+}
+
+int main(int argc,char* argv[]){
+  std::string name = "/xlog";
+  std::string out;
+  size_t ring_mb = 64;
+  size_t roll_mb = 0;
+  bool drain_exit = false;
+  bool unlink_at_exit = false;
+  int c;
+  while((c = getopt(argc,argv,"n:o:s:r:duh"))!=-1){
+    switch(c){
+      case 'n': name = optarg; break;
+      case 'o': out = optarg; break;
+      case 's': ring_mb = strtoul(optarg,nullptr,10); break;
+      case 'r': roll_mb = strtoul(optarg,nullptr,10); break;
+      case 'd': drain_exit = true; break;
+      case 'u': unlink_at_exit = true; break;
+      default: usage(); return c=='h'? 0:1;
+    }
+  }
+  if(out.empty()){
+    usage();
+    return 1;
+  }
+  signal(SIGINT,onSignal);
+  signal(SIGTERM,onSignal);
+
+  log::ShmRing ring(name,ring_mb*1024*1024);
+  log::LogSink::s_ptr sink = roll_mb? log::SinkFactory::create<log::RollBySizeSink>(out,roll_mb*1024*1024)
+                                    : log::SinkFactory::create<log::FileSink>(out);
+
+  log::Buffer buf;
+  const size_t batch_limit = 1024*1024;
+  auto flush = [&](){
+    if(buf.empty()) return;
+    sink->write(buf.begin(),buf.readAbleSize());
+    buf.reset();
+  };
+  auto onRecord = [&](const char* data,size_t len){
+    buf.push(data,len);
+    if(buf.readAbleSize()>=batch_limit) flush();
+  };
+
+  uint64_t total = 0;
+  unsigned idle = 0;
+  //每轮都检查g_stop: 生产者持续写入时consume总能取到数据,不能只在空闲时检查
+  while(!g_stop){
+    size_t n = ring.consume(onRecord);
+    flush();
+    total += n;
+    if(n){
+      idle = 0;
+      continue;
+    }
+    if(drain_exit && ring.pending()==0) break;
+    //空闲退避: 先让出CPU,再逐步延长休眠
+    if(++idle<64) sched_yield();
+    else usleep(idle<256? 50:1000);
+  }
+  //退出前再取一次剩余记录,尽量不丢已发布的记录
+  total += ring.consume(onRecord);
+  flush();
+
+  std::cout<<"xlog-shipper: 写出 "<<total<<" 字节, 环满丢弃 "<<ring.drops()<<" 字节, 跳过未提交 "<<ring.skipped()<<" 字节\n";
+  if(unlink_at_exit) log::ShmRing::unlink(name);
+  return 0;
+}